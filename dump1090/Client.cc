@@ -6,10 +6,12 @@
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
+#include <cstdlib>
 
 extern "C" {
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 }
 
@@ -20,10 +22,32 @@ namespace modes {
   const static std::string MODES_CONTENT_TYPE_JSON = 
     std::string("application/json;charset=utf-8");
 
-  int hexDigitVal(int c);
   char *aircraftsToJson(int *len);
+  char *statsToJson(int *len);
 
-  int handleHTTPRequest(struct client *c)
+  static const int RING_SIZE = modesDecode::MODES_CLIENT_BUF_SIZE;
+
+  /* Hex digit -> 4 bit value, -1 if the character is not an hex digit. */
+  static const signed char hexval[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+     0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+    -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  };
+
+  int handleHTTPRequest(struct client *c, char *req)
   {
     char hdr[512];
     int clen, hdrlen;
@@ -32,20 +56,20 @@ namespace modes {
     const char *ctype;
   
     if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
-      ::printf("\nHTTP request: %s\n", c->buf);
+      ::printf("\nHTTP request: %s\n", req);
   
     /* Minimally parse the request. */
-    httpver = (::strstr(c->buf, "HTTP/1.1") != NULL) ? 11 : 10;
+    httpver = (::strstr(req, "HTTP/1.1") != NULL) ? 11 : 10;
     if (httpver == 10) {
       /* HTTP 1.0 defaults to close, unless otherwise specified. */
-      keepalive = ::strstr(c->buf, "Connection: keep-alive") != NULL;
+      keepalive = ::strstr(req, "Connection: keep-alive") != NULL;
     } else if (httpver == 11) {
       /* HTTP 1.1 defaults to keep-alive, unless close is specified. */
-      keepalive = ::strstr(c->buf, "Connection: close") == NULL;
+      keepalive = ::strstr(req, "Connection: close") == NULL;
     }
   
     /* Identify he URL. */
-    p = ::strchr(c->buf,' ');
+    p = ::strchr(req,' ');
     if (!p) return 1; /* There should be the method and a space... */
     url = ++p; /* Now this should point to the requested URL. */
     p = ::strchr(p, ' ');
@@ -57,12 +81,16 @@ namespace modes {
       ::printf("HTTP requested URL: %s\n\n", url);
     }
   
-    /* Select the content to send, we have just two so far:
+    /* Select the content to send, we have just three so far:
      * "/" -> Our google map application.
-     * "/data.json" -> Our ajax request to update aircrafts. */
+     * "/data.json" -> Our ajax request to update aircrafts.
+     * "/stats.json" -> Load and decoding level, for monitoring. */
     if (::strstr(url, "/data.json")) {
       content = aircraftsToJson(&clen);
       ctype = MODES_CONTENT_TYPE_JSON.c_str();
+    } else if (::strstr(url, "/stats.json")) {
+      content = statsToJson(&clen);
+      ctype = MODES_CONTENT_TYPE_JSON.c_str();
     } else {
       struct stat sbuf;
       int fd = -1;
@@ -118,13 +146,39 @@ namespace modes {
   }
 
 
+  /* Return the load shedding state in json. "level_blocks" counts the
+   * blocks decoded at every level, from MODES_LOAD_FULL on. */
+  char *statsToJson(int *len) {
+    struct modesDecode::modesLoad *l = &modesDecode::Modes.load;
+    char buf[512];
+    int j;
+
+    *len = ::snprintf(buf,sizeof(buf),
+                      "{\"load\":%d, \"level\":%d, \"level_name\":\"%s\", "
+                      "\"overloaded_blocks\":%ld, \"blocks\":%ld, "
+                      "\"steps_down\":%ld, \"steps_up\":%ld, "
+                      "\"level_blocks\":[",
+                      l->load, l->level,
+                      modesDecode::modesLoadLevelName(l->level),
+                      l->stat_overloaded, l->stat_blocks,
+                      l->stat_down, l->stat_up);
+    for (j = 0; j < modesDecode::MODES_LOAD_LEVELS; j++)
+        *len += ::snprintf(buf+*len,sizeof(buf)-*len,"%s%ld",
+                           j ? "," : "", l->stat_level_blocks[j]);
+    *len += ::snprintf(buf+*len,sizeof(buf)-*len,"]}\n");
+    return ::strdup(buf);
+  }
+
   /* Return a description of aircrafts in json. */
   char *aircraftsToJson(int *len) {
-    struct modeSMessage::aircraft *a = modesDecode::Modes.aircrafts;
+    struct modeSMessage::aircraft *a;
     int buflen = 1024; /* The initial buffer is incremented as needed. */
     char *buf = (char*)::malloc(buflen), *p = buf;
     int l;
 
+    /* The list is updated by the decoder thread. */
+    ::pthread_mutex_lock(&modesDecode::Modes.aircrafts_mutex);
+    a = modesDecode::Modes.aircrafts;
     l = ::snprintf(p,buflen,"[\n");
     p += l; buflen -= l;
     while(a) {
@@ -137,12 +191,18 @@ namespace modes {
       }
 
       if (a->lat != 0 && a->lon != 0) {
+        char rssi[32] = "";
+
+        /* Unknown for the messages received from the network. */
+        if (a->signal)
+          ::snprintf(rssi,sizeof(rssi),", \"rssi\":%.1f",
+                     modesDecode::signalToDbfs(a->signal));
         l = ::snprintf(p,buflen,
                        "{\"hex\":\"%s\", \"flight\":\"%s\", \"lat\":%f, "
                        "\"lon\":%f, \"altitude\":%d, \"track\":%d, "
-                       "\"speed\":%d},\n",
+                       "\"speed\":%d%s},\n",
                        a->hexaddr, a->flight, a->lat, a->lon, a->altitude, a->heading,
-                       a->speed);
+                       a->speed, rssi);
         p += l; buflen -= l;
         /* Resize if needed. */
         if (buflen < 256) {
@@ -154,6 +214,7 @@ namespace modes {
       }
       a = a->next;
     }
+    ::pthread_mutex_unlock(&modesDecode::Modes.aircrafts_mutex);
     /* Remove the final comma if any, and closes the json array. */
     if (*(p-2) == ',') {
       *(p-2) = '\n';
@@ -168,12 +229,14 @@ namespace modes {
   }
 
 
-  int decodeHexMessage(struct client *c)  
+  int decodeHexMessage(struct client *c, char *hex)
   {
-    char *hex = c->buf;
     int l = ::strlen(hex), j;
     unsigned char msg[modesDecode::MODES_LONG_MSG_BYTES];
     struct modeSMessage::modesMessage mm;
+    uint64_t time;
+    char *delim;
+    (void)c;
 
     /* Remove spaces on the left and on the right. */
     while(l && ::isspace(hex[l-1])) {
@@ -185,17 +248,12 @@ namespace modes {
       l--;
     }
 
-    /* find the * character */
-    char* delim = strstr(hex, "*");
+    /* The time stamp is in front of the * character. */
+    delim = (char*)::memchr(hex, '*', l);
     if (delim == NULL) return 1;
-    delim[0] = '\0';
-
-    /* read the time */
-    clock_t time = 0l;
-    sscanf(hex, "%ld", &time);
-    delim[0] = '*';
-    hex = delim;
+    time = modeSMessage::modesParseTime(hex);
     l -= (delim-hex);
+    hex = delim;
 
     /* Turn the message into binary. */
     if (l < 2 || hex[0] != '*' || hex[l-1] != ';') return 0;
@@ -203,26 +261,69 @@ namespace modes {
     if (l > modesDecode::MODES_LONG_MSG_BYTES*2) return 0; 
     /* Too long message... broken. */
     for (j = 0; j < l; j += 2) {
-      int high = hexDigitVal(hex[j]);
-      int low = hexDigitVal(hex[j+1]);
+      int high = hexval[(unsigned char)hex[j]];
+      int low = hexval[(unsigned char)hex[j+1]];
 
       if (high == -1 || low == -1) return 0;
       msg[j/2] = (high<<4) | low;
     }
     modesDecode::decodeModesMessage(&mm,msg);
-    modesDecode::useModesMessage(&time, &mm);
+    modesDecode::modesPipelinePushNet(&time, &mm);
     return 0;
   }
 
+  /* Return 1 if the complete separator 'sep' of length 'seplen' ends at
+   * the ring position 'end' (excluded), and belongs to the current line. */
+  static int ringHasSep(struct clientInput *in, unsigned int end,
+                        const char *sep, int seplen)
+  {
+    int j;
+
+    if (end - in->rpos < (unsigned int)seplen) return 0;
+    for (j = 0; j < seplen; j++) {
+      unsigned int pos = (end - seplen + j) & (RING_SIZE-1);
+      if (in->buf[pos] != sep[j]) return 0;
+    }
+    return 1;
+  }
+
   void modesReadFromClient(struct client *c, char *sep,
-                           int(*handler)(struct client *))
+                           int(*handler)(struct client *, char *))
   {
+    int seplen = ::strlen(sep);
+    char last = sep[seplen-1];
+    char wrapped[RING_SIZE+1];
+    struct clientInput *in = c->in;
+
+    if (in == NULL) {
+      in = c->in = (struct clientInput*)::malloc(sizeof(*in));
+      if (in == NULL) {
+        modeSMessage::modesFreeClient(c->fd);
+        return;
+      }
+      in->rpos = in->spos = in->wpos = 0;
+    }
+
     while(1) {
-      int left = modesDecode::MODES_CLIENT_BUF_SIZE - c->buflen;
-      int nread = ::read(c->fd, c->buf+c->buflen, left);
-      int fullmsg = 0;
-      int i;
-      char *p;
+      unsigned int used = in->wpos - in->rpos;
+      unsigned int wr = in->wpos & (RING_SIZE-1);
+      struct iovec iov[2];
+      int left, nread;
+
+      /* If our buffer is full without a separator discard it, this is
+       * some badly formatted shit. */
+      if (used == RING_SIZE) {
+        in->rpos = in->spos = in->wpos;
+        used = 0;
+      }
+      left = RING_SIZE - used;
+
+      /* Read into the free space of the ring, that may wrap around. */
+      iov[0].iov_base = in->buf + wr;
+      iov[0].iov_len = (wr + left > RING_SIZE) ? RING_SIZE - wr : left;
+      iov[1].iov_base = in->buf;
+      iov[1].iov_len = left - iov[0].iov_len;
+      nread = ::readv(c->fd, iov, iov[1].iov_len ? 2 : 1);
 
       if (nread <= 0) {
         if (nread == 0 || errno != EAGAIN) {
@@ -231,53 +332,56 @@ namespace modes {
         }
         break; /* Serve next client. */
       }
-      c->buflen += nread;
+      in->wpos += nread;
 
-      /* Always null-term so we are free to use strstr() */
-      c->buf[c->buflen] = '\0';
+      /* Only scan the bytes we never looked at, looking for the last
+       * character of the separator. */
+      while (in->spos != in->wpos) {
+        unsigned int pos = in->spos & (RING_SIZE-1);
+        unsigned int seg = in->wpos - in->spos;
+        unsigned int msglen;
+        char *p, *line;
+
+        if (pos + seg > RING_SIZE) seg = RING_SIZE - pos;
+        p = (char*)::memchr(in->buf + pos, last, seg);
+        if (p == NULL) {
+          in->spos += seg;
+          continue;
+        }
+        in->spos += (p - (in->buf + pos)) + 1;
+        if (!ringHasSep(in, in->spos, sep, seplen)) continue;
+
+        /* We have a full message: the handler expects a null terminated
+         * string, that we can create in place overwriting the separator,
+         * unless the message wraps around the end of the ring. */
+        msglen = in->spos - in->rpos - seplen;
+        pos = in->rpos & (RING_SIZE-1);
+        if (pos + msglen <= RING_SIZE) {
+          line = in->buf + pos;
+        } else {
+          unsigned int first = RING_SIZE - pos;
+
+          ::memcpy(wrapped, in->buf + pos, first);
+          ::memcpy(wrapped + first, in->buf, msglen - first);
+          line = wrapped;
+        }
+        line[msglen] = '\0';
+        in->rpos = in->spos;
 
-      /* If there is a complete message there must be the separator 'sep'
-       * in the buffer, note that we full-scan the buffer at every read
-       * for simplicity. */
-      while ((p = strstr(c->buf, sep)) != NULL) {
-        i = p - c->buf; /* Turn it as an index inside the buffer. */
-        c->buf[i] = '\0'; /* Te handler expects null terminated strings. */
         /* Call the function to process the message. It returns 1
          * on error to signal we should close the client connection. */
-        if (handler(c)) {
+        if (handler(c, line)) {
           modeSMessage::modesFreeClient(c->fd);
           return;
         }
-        /* Move what's left at the start of the buffer. */
-        i += strlen(sep); /* The separator is part of the previous msg. */
-        ::memmove(c->buf,c->buf+i,c->buflen-i);
-        c->buflen -= i;
-        c->buf[c->buflen] = '\0';
-        /* Maybe there are more messages inside the buffer.
-         * Start looping from the start again. */
-        fullmsg = 1;
       }
-      /* If our buffer is full discard it, this is some badly
-       * formatted shit. */
-      if (c->buflen == modesDecode::MODES_CLIENT_BUF_SIZE) {
-        c->buflen = 0;
-        /* If there is garbage, read more to discard it ASAP. */
-        continue;
-      }
-      /* If no message was decoded process the next client, otherwise
-       * read more data from the same client. */
-      if (!fullmsg) break;
+
+      /* If the socket may have more data read it now, otherwise process
+       * the next client. */
+      if (nread < left) break;
     }
   }
 
-  /* Turn an hex digit into its 4 bit decimal value.
-   * Returns -1 if the digit is not in the 0-F range. */
-  int hexDigitVal(int c) {
-    c = tolower(c);
-    if (c >= '0' && c <= '9') return c-'0';
-    else if (c >= 'a' && c <= 'f') return c-'a'+10;
-    else return -1;
-  }
 
 
 }
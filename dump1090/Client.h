@@ -3,14 +3,31 @@
 
 #include "modesDecode.h"
 
+namespace modeSMessage {
+  struct clientFilter;
+}
+
 namespace modes {
 
-  /* Structure used to describe a modes client. */
+  /* Read buffer of the clients of the input services (raw input, HTTP). */
+  struct clientInput {
+    char buf[modesDecode::MODES_CLIENT_BUF_SIZE+1]; /* Read ring buffer. */
+    unsigned int rpos;  /* Start of the message being received. */
+    unsigned int spos;  /* Data before this position was already scanned. */
+    unsigned int wpos;  /* End of the data read so far. */
+  };
+
+  /* Structure used to describe a modes client. Clients of the output
+   * services only get a read buffer if they send a filter. */
   struct client {
     int fd;         /* File descriptor. */
     int service;    /* TCP port the client is connected to. */
-    char buf[modesDecode::MODES_CLIENT_BUF_SIZE+1];    /* Read buffer. */
-    int buflen;                         /* Amount of data on buffer. */
+    struct clientInput *in; /* Read buffer, allocated by the first read. */
+    struct modeSMessage::clientFilter *filter; /* Output filter, or NULL. */
+    char *out;      /* Pending output of a client with a filter. */
+    int outlen;
+    int matched;    /* The filter accepted the current message. */
+    int closing;    /* Write failed, waiting for the network thread. */
   };
 
   /* Get an HTTP request header and write the response to the client.
@@ -19,12 +36,11 @@ namespace modes {
    *
    * Returns 1 on error to signal the caller the client connection should
    * be closed. */
-  int handleHTTPRequest(struct client *c);
+  int handleHTTPRequest(struct client *c, char *req);
 
   /* This function decodes a string representing a Mode S message in
    * raw hex format like: *8D4B969699155600E87406F5B69F;
-   * The string is supposed to be at the start of the client buffer
-   * and null-terminated.
+   * The string is null-terminated and may be modified.
    * 
    * The message is passed to the higher level layers, so it feeds
    * the selected screen output, the network output and so forth.
@@ -34,7 +50,7 @@ namespace modes {
    * The function always returns 0 (success) to the caller as there is
    * no case where we want broken messages here to close the client
    * connection. */
-  int decodeHexMessage(struct client *c);
+  int decodeHexMessage(struct client *c, char *hex);
 
   /* This function polls the clients using read() in order to receive new
    * messages from the net.
@@ -42,14 +58,15 @@ namespace modes {
    * The message is supposed to be separated by the next message by the
    * separator 'sep', that is a null-terminated C string.
    *
-   * Every full message received is decoded and passed to the higher layers
-   * calling the function 'handler'.
+   * The client buffer is used as a ring: every byte received is scanned
+   * only once, and all the complete messages are passed, null-terminated,
+   * to the function 'handler' without moving the data around.
    *
    * The handler returns 0 on success, or 1 to signal this function we
    * should close the connection with the client in case of non-recoverable
    * errors. */
   void modesReadFromClient(struct client *c, char *sep,
-                           int(*handler)(struct client *));
+                           int(*handler)(struct client *, char *));
 
 } // namespace
 
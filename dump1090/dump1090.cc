@@ -41,6 +41,7 @@ extern "C" {
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -106,8 +107,21 @@ void modesInitNet(void) {
          &modesDecode::Modes.sbsos, modesDecode::Modes.net_output_sbs_port}
     };
 
-    ::memset(modesDecode::Modes.clients,0,sizeof(modesDecode::Modes.clients));
+    modesDecode::Modes.clients_len = modesDecode::MODES_NET_CLIENTS_INIT;
+    modesDecode::Modes.clients = (struct modes::client**)
+      ::calloc(modesDecode::Modes.clients_len, sizeof(struct modes::client*));
     modesDecode::Modes.maxfd = -1;
+    modesDecode::Modes.raw_clients = modesDecode::Modes.sbs_clients = 0;
+    modesDecode::Modes.filtered = NULL;
+    modesDecode::Modes.filtered_len = modesDecode::Modes.filtered_size = 0;
+
+    /* The clients table grows as needed, let the number of clients only be
+     * limited by the hard limit of open files. */
+    struct rlimit rl;
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &rl);
+    }
 
     signal(SIGPIPE, SIG_IGN);
 
@@ -135,6 +149,8 @@ void showHelp(void) {
 "--interactive            Interactive mode refreshing data on screen.\n"
 "--interactive-rows <num> Max number of rows in interactive mode (default: 15).\n"
 "--interactive-ttl <sec>  Remove from list if idle for <sec> (default: 60).\n"
+"--max-aircrafts <num>    Max number of tracked aircrafts (default: 2048).\n"
+"--icao-cache <num>       Size of the recently seen ICAO addresses cache (default: 1024).\n"
 "--raw                    Show only messages hex values.\n"
 "--net                    Enable networking.\n"
 "--net-only               Enable just networking, no RTL device or file used.\n"
@@ -142,9 +158,14 @@ void showHelp(void) {
 "--net-ri-port <port>     TCP listening port for raw input (default: 30001).\n"
 "--net-http-port <port>   HTTP server port (default: 8080).\n"
 "--net-sbs-port <port>    TCP listening port for BaseStation format output (default: 30003).\n"
+"--net-push <host:port>   Push the raw output to a remote host (can be repeated).\n"
+"--net-udp <addr:port>    Send the raw output over UDP, multicast or unicast (can be repeated).\n"
+"--net-udp-ttl <hops>     TTL of the UDP multicast output (default: 1).\n"
 "--no-fix                 Disable single-bits error correction using CRC.\n"
 "--no-crc-check           Disable messages with broken CRC (discouraged).\n"
 "--aggressive             More CPU for more messages (two bits fixes, ...).\n"
+"--no-squelch             Demodulate the quiet parts of the signal too.\n"
+"--profile <name>         low-power (less CPU) or max-decode (more messages).\n"
 "--stats                  With --ifile print stats at exit. No other output.\n"
 "--onlyaddr               Show only ICAO addresses (testing purposes).\n"
 "--metric                 Use metric units (meters, km/h, ...).\n"
@@ -206,16 +227,53 @@ int main(int argc, char **argv) {
             modesDecode::Modes.net_http_port = atoi(argv[++j]);
         } else if (!::strcmp(argv[j],"--net-sbs-port") && more) {
             modesDecode::Modes.net_output_sbs_port = atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--net-push") && more) {
+            if (modeSMessage::modesAddPushTarget(argv[++j]) == -1) {
+                ::fprintf(stderr, "Bad --net-push target: %s\n", argv[j]);
+                ::exit(1);
+            }
+            modesDecode::Modes.net = 1;
+        } else if (!::strcmp(argv[j],"--net-udp") && more) {
+            if (modeSMessage::modesAddUdpDestination(argv[++j]) == -1) {
+                ::fprintf(stderr, "Bad --net-udp destination: %s\n", argv[j]);
+                ::exit(1);
+            }
+            modesDecode::Modes.net = 1;
+        } else if (!::strcmp(argv[j],"--net-udp-ttl") && more) {
+            modesDecode::Modes.udp.ttl = atoi(argv[++j]);
         } else if (!::strcmp(argv[j],"--onlyaddr")) {
             modesDecode::Modes.onlyaddr = 1;
         } else if (!::strcmp(argv[j],"--metric")) {
             modesDecode::Modes.metric = 1;
         } else if (!::strcmp(argv[j],"--aggressive")) {
             modesDecode::Modes.aggressive++;
+        } else if (!::strcmp(argv[j],"--profile") && more) {
+            j++;
+            if (!::strcmp(argv[j],"low-power")) {
+                modesDecode::Modes.profile = modesDecode::MODES_PROFILE_LOW_POWER;
+            } else if (!::strcmp(argv[j],"max-decode")) {
+                modesDecode::Modes.profile = modesDecode::MODES_PROFILE_MAX_DECODE;
+            } else {
+                ::fprintf(stderr, "Unknown profile: %s\n", argv[j]);
+                ::exit(1);
+            }
+        } else if (!::strcmp(argv[j],"--no-squelch")) {
+            modesDecode::Modes.squelch = 0;
         } else if (!::strcmp(argv[j],"--interactive")) {
             modesDecode::Modes.interactive = 1;
         } else if (!::strcmp(argv[j],"--interactive-rows")) {
             modesDecode::Modes.interactive_rows = atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--icao-cache") && more) {
+            int len = atoi(argv[++j]);
+
+            /* Round to a power of two, with at least one set. */
+            modesDecode::Modes.icao_cache_len = modesDecode::MODES_ICAO_CACHE_WAYS;
+            while (modesDecode::Modes.icao_cache_len < len)
+                modesDecode::Modes.icao_cache_len *= 2;
+        } else if (!::strcmp(argv[j],"--max-aircrafts") && more) {
+            modesDecode::Modes.max_aircrafts = atoi(argv[++j]);
+            if (modesDecode::Modes.max_aircrafts < 1)
+                modesDecode::Modes.max_aircrafts = 1;
         } else if (!::strcmp(argv[j],"--interactive-ttl")) {
             modesDecode::Modes.interactive_ttl = atoi(argv[++j]);
         } else if (!::strcmp(argv[j],"--debug") && more) {
@@ -253,6 +311,15 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The profiles override the options they are made of. */
+    if (modesDecode::Modes.profile == modesDecode::MODES_PROFILE_LOW_POWER) {
+        modesDecode::Modes.aggressive = 0;
+    } else if (modesDecode::Modes.profile == modesDecode::MODES_PROFILE_MAX_DECODE) {
+        if (!modesDecode::Modes.aggressive) modesDecode::Modes.aggressive = 1;
+        modesDecode::Modes.fix_errors = 1;
+        modesDecode::Modes.squelch = 0;
+    }
+
     /* Initialization */
     modesDecode::modesInit();
     if (modesDecode::Modes.net_only) {
@@ -286,13 +353,26 @@ int main(int argc, char **argv) {
               }
           }
       }
-    if (modesDecode::Modes.net) modesInitNet();
+    if (modesDecode::Modes.net) {
+        modesInitNet();
+        modeSMessage::modesInitUdp();
+    }
+
+    /* Create the thread that decodes the demodulated messages, and
+     * performs the background tasks. */
+    modesDecode::modesInitPipeline();
+    modesDecode::modesInitLoad();
+    ::pthread_create(&modesDecode::Modes.pipeline.decoder_thread, NULL,
+                     modesDecode::decoderThreadEntryPoint, NULL);
+    if (modesDecode::Modes.net)
+        ::pthread_create(&modesDecode::Modes.net_thread, NULL,
+                         modeSMessage::netThreadEntryPoint, NULL);
 
     /* If the user specifies --net-only, just run in order to serve network
      * clients without reading data from the RTL device. */
-    while (modesDecode::Modes.net_only) {
-      modeSMessage::backgroundTasks();
-        usleep(100000);
+    if (modesDecode::Modes.net_only) {
+        ::pthread_join(modesDecode::Modes.pipeline.decoder_thread, NULL);
+        return 0;
     }
 
     /* Create the thread that will read the data from the device. */
@@ -301,12 +381,19 @@ int main(int argc, char **argv) {
 
     ::pthread_mutex_lock(&modesDecode::Modes.data_mutex);
     while(1) {
+        uint64_t block;
+        long start;
+
         if (!modesDecode::Modes.data_ready) {
             ::pthread_cond_wait(&modesDecode::Modes.data_cond,
                                 &modesDecode::Modes.data_mutex);
             continue;
         }
+        start = modeSMessage::ustime();
         modesDecode::computeMagnitudeVector();
+        /* Time stamp of the first sample of the magnitude vector. */
+        block = modesDecode::Modes.clock.samples -
+                modesDecode::Modes.data_len/2;
 
         /* Signal to the other thread that we processed the available data
          * and we want more (useful for --ifile). */
@@ -318,13 +405,20 @@ int main(int argc, char **argv) {
          * stuff * at the same time. (This should only be useful with very
          * slow processors). */
         ::pthread_mutex_unlock(&modesDecode::Modes.data_mutex);
-        modesDecode::detectModeS(&modesDecode::Modes.time,
+        modesDecode::detectModeS(&block,
                                  modesDecode::Modes.magnitude, 
                                  modesDecode::Modes.data_len/2);
-        modeSMessage::backgroundTasks();
+        start = modeSMessage::ustime() - start;
+        modesDecode::Modes.pipeline.stat_demod_us += start;
+        modesDecode::modesLoadUpdate(start, modesDecode::Modes.data_len/2);
         ::pthread_mutex_lock(&modesDecode::Modes.data_mutex);
-        if (modesDecode::Modes.exit) break;
+        /* Stop after the last block of the file. */
+        if (modesDecode::Modes.exit && !modesDecode::Modes.data_ready) break;
     }
+    ::pthread_mutex_unlock(&modesDecode::Modes.data_mutex);
+
+    /* Let the decoder thread process what is still in the pipeline. */
+    modesDecode::modesPipelineStop();
 
     /* If --ifile and --stats were given, print statistics. */
     if (modesDecode::Modes.stats && modesDecode::Modes.ifilename) {
@@ -338,8 +432,19 @@ int main(int argc, char **argv) {
         ::printf("%ld errors corrected\n", modesDecode::Modes.stat_fixed);
         ::printf("%ld single bit errors\n", modesDecode::Modes.stat_single_bit_fix);
         ::printf("%ld two bits errors\n", modesDecode::Modes.stat_two_bits_fix);
+        ::printf("%ld errors fixed flipping weak bits\n", modesDecode::Modes.stat_soft_fix);
+        ::printf("%ld AP single bit errors fixed with the ICAO cache\n", modesDecode::Modes.stat_ap_fix);
         ::printf("%ld total usable messages\n",
             modesDecode::Modes.stat_goodcrc + modesDecode::Modes.stat_fixed);
+        modesDecode::modesPipelineShowStats();
+        modesDecode::modesLoadShowStats();
+        modeSMessage::modesPushShowStats();
+        modeSMessage::modesUdpShowStats();
+        modeSMessage::trackerShowStats();
+        modesDecode::ICAOCacheShowStats();
+        modesDecode::signalShowStats();
+        modesDecode::squelchShowStats();
+        modesDecode::profileShowStats();
     }
 
     ::rtlsdr_close(modesDecode::Modes.dev);
@@ -5,6 +5,16 @@
 namespace modesDecode {
 
 static const  int MODES_DEFAULT_RATE        =2000000;
+static const  int MODES_TIME_STR_LEN        =21;   /* 64 bit time stamp + nul. */
+static const  int MODES_SIGNAL_FULL_SCALE   =128*360; /* Magnitude at 0 dBFS. */
+static const  int MODES_NOISE_BINS          =1024; /* Noise histogram, 64 levels per bin. */
+static const  int MODES_NOISE_DECIMATION    =16;   /* Samples skipped measuring noise. */
+static const  int MODES_SQUELCH_SHIFT       =6;    /* Squelch windows of 64 samples. */
+static const  int MODES_SQUELCH_WINDOW      =1 << MODES_SQUELCH_SHIFT;
+static const  int MODES_PULSE_FACTOR        =2;    /* Same, preamble pulse, low-power. */
+static const  int MODES_SOFT_BITS           =8;    /* Weakest bits tried by soft fixes. */
+static const  int MODES_SOFT_MAX_FLIPS      =3;    /* Max bits flipped, DF11 / DF17. */
+static const  int MODES_SOFT_MAX_FLIPS_AP   =2;    /* Max bits flipped, AP DFs. */
 static const  int MODES_DEFAULT_FREQ        =1090000000;
 static const  int MODES_DEFAULT_WIDTH       =1000;
 static const  int MODES_DEFAULT_HEIGHT      =700;
@@ -16,11 +26,16 @@ static const int MODES_MAX_GAIN             =999999;       /* Use max available
 static const  int MODES_PREAMBLE_US         =8;       /* microseconds */
 static const  int MODES_LONG_MSG_BITS       =112;
 static const  int MODES_SHORT_MSG_BITS      =56;
+static const  int MODES_DF_BITS             =5;    /* Downlink Format field. */
 static const  int MODES_FULL_LEN            =(MODES_PREAMBLE_US+MODES_LONG_MSG_BITS);
+static const  int MODES_MIN_DELTA           =10*255; /* Min avg high/low delta, x2. */
+static const  int MODES_SQUELCH_SPAN        =((MODES_SQUELCH_WINDOW-1+MODES_FULL_LEN*2-1)
+                                              >> MODES_SQUELCH_SHIFT)+1; /* Windows. */
 static const  int MODES_LONG_MSG_BYTES      =(112/8);
 static const  int MODES_SHORT_MSG_BYTES     =(56/8);
 
-static const  int MODES_ICAO_CACHE_LEN      =1024; /* Power of two required. */
+static const  int MODES_ICAO_CACHE_LEN      =1024; /* Default, power of two required. */
+static const  int MODES_ICAO_CACHE_WAYS     =4;    /* Entries per set. */
 static const unsigned int MODES_ICAO_CACHE_TTL =60;   /* Time to live of cached addresses. */
 static const  int MODES_UNIT_FEET   =0;
 static const  int MODES_UNIT_METERS =1;
@@ -41,13 +56,47 @@ static const int MODES_INTERACTIVE_REFRESH_TIME =500 ;     /* Milliseconds */
 static const int MODES_INTERACTIVE_ROWS =15;               /* Rows on screen */
 static const int MODES_INTERACTIVE_TTL =60;                /* TTL before being removed */
 
-static const int MODES_NET_MAX_FD          =1024;
+static const int MODES_NET_CLIENTS_INIT    =64; /* Grows as needed. */
 static const int MODES_NET_OUTPUT_SBS_PORT =30003;
 static const int MODES_NET_OUTPUT_RAW_PORT =30002;
 static const int MODES_NET_INPUT_RAW_PORT  =30001;
 static const int MODES_NET_HTTP_PORT       =8080;
 static const int MODES_CLIENT_BUF_SIZE     =1024;
 static const int MODES_NET_SNDBUF_SIZE     =(1024*64);
+static const int MODES_NET_OUT_BUF_SIZE    =(1024*16); /* Flushed once per batch. */
+static const int MODES_NET_POLL_MS         =1000;
+static const int MODES_NET_PUSH_SPOOL_SIZE =(1024*1024); /* Per push target. */
+static const int MODES_NET_PUSH_BACKOFF_MIN=1000;  /* Reconnection delay, ms. */
+static const int MODES_NET_PUSH_BACKOFF_MAX=60000;
+static const int MODES_NET_PUSH_CONNECT_TIMEOUT=10000; /* ms */
+static const int MODES_NET_UDP_PAYLOAD     =1472;  /* Ethernet MTU - IP/UDP. */
+static const int MODES_NET_UDP_TTL         =1;     /* Default multicast TTL. */
+static const int MODES_FILTER_MAX_PREFIXES =16;    /* Per client filter. */
+static const int MODES_AIRCRAFT_SLAB       =128;   /* Aircrafts per pool slab. */
+static const int MODES_EXPIRY_WHEEL_SIZE   =64;    /* Seconds, see interactiveRemoveStaleAircrafts(). */
+static const int MODES_MAX_AIRCRAFTS       =2048;  /* Default tracker cap. */
+static const int MODES_PROBATION_LEN       =1024;  /* Power of two required. */
+static const int MODES_PROBATION_FRAMES    =2;     /* Good CRC frames to admit. */
+static const int MODES_PROBATION_TTL       =10;    /* Seconds. */
+
+static const int MODES_BATCH_LEN           =512;  /* Messages per decode batch. */
+static const int MODES_PIPELINE_DEPTH      =8;    /* Batches in the pipeline ring. */
+static const int MODES_PIPELINE_IDLE_US    =100000; /* Idle decoder wake up. */
+
+static const int MODES_PROFILE_DEFAULT     =0;
+static const int MODES_PROFILE_LOW_POWER   =1;    /* Less CPU, a few less messages. */
+static const int MODES_PROFILE_MAX_DECODE  =2;    /* Every message we can get. */
+
+static const int MODES_LOAD_FULL           =0;    /* Everything enabled. */
+static const int MODES_LOAD_NO_SOFT_FIX    =1;    /* No weak bits / AP single bit fixes. */
+static const int MODES_LOAD_NO_TWO_BITS    =2;    /* No two bits fixes. */
+static const int MODES_LOAD_NO_PHASE       =3;    /* No phase correction retry. */
+static const int MODES_LOAD_NO_TRACKING    =4;    /* No tracking for HTTP clients. */
+static const int MODES_LOAD_LEVELS         =5;
+static const int MODES_LOAD_HIGH           =80;   /* Busy % of the block time... */
+static const int MODES_LOAD_LOW            =40;   /* ...to shed / restore work. */
+static const int MODES_LOAD_HOLD_DOWN      =8;    /* Blocks between transitions... */
+static const int MODES_LOAD_HOLD_UP        =64;   /* ...down and up. */
 
 static const int MODES_SQUAWK              = 1000; /* decimal notation - but meant octal*/
 
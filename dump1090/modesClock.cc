@@ -0,0 +1,72 @@
+
+#include "modesClock.h"
+#include "modesDecode.h"
+
+extern "C" {
+#include <sys/time.h>
+}
+
+namespace modeSMessage {
+
+void modesClockTick(void) {
+    struct modesClock *c = &modesDecode::Modes.clock;
+    struct timeval tv;
+    struct timespec ts;
+
+    ::gettimeofday(&tv, NULL);
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    c->wall = tv.tv_sec;
+    c->wall_ms = ((long)tv.tv_sec)*1000 + tv.tv_usec/1000;
+    c->mono_ms = ((long)ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+}
+
+time_t modesClockSec(void) {
+    return modesDecode::Modes.clock.wall;
+}
+
+long modesClockMs(void) {
+    return modesDecode::Modes.clock.wall_ms;
+}
+
+long modesClockMonoMs(void) {
+    return modesDecode::Modes.clock.mono_ms;
+}
+
+void modesClockAdvance(uint32_t n) {
+    struct modesClock *c = &modesDecode::Modes.clock;
+
+    /* The sample clock and the wall clock are related once, at the first
+     * block: later the wall clock may be adjusted. */
+    if (c->sample0_ms == 0)
+        c->sample0_ms = c->wall_ms -
+          (long)(c->samples*1000/modesDecode::MODES_DEFAULT_RATE);
+    c->samples += n;
+}
+
+long modesSampleToMs(uint64_t t) {
+    return modesDecode::Modes.clock.sample0_ms +
+           (long)(t*1000/modesDecode::MODES_DEFAULT_RATE);
+}
+
+/* There is no printf() format for 64 bit integers in C++98. */
+int modesFormatTime(char *buf, uint64_t t) {
+    char digits[modesDecode::MODES_TIME_STR_LEN];
+    int len = 0, j;
+
+    do {
+        digits[len++] = '0' + t % 10;
+        t /= 10;
+    } while (t);
+    for (j = 0; j < len; j++) buf[j] = digits[len-1-j];
+    buf[len] = '\0';
+    return len;
+}
+
+uint64_t modesParseTime(const char *s) {
+    uint64_t t = 0;
+
+    while (*s >= '0' && *s <= '9') t = t*10 + (*s++ - '0');
+    return t;
+}
+
+} // namespace
@@ -0,0 +1,59 @@
+#ifndef MODESCLOCK_H
+#define MODESCLOCK_H
+
+#include <time.h>
+#include <stdint.h>
+
+namespace modeSMessage {
+
+/* Process wide clock. Reading the time for every message costs thousands
+ * of system calls per second, so the wall clock and the monotonic clock
+ * are read once per block of samples (and once per loop by the network
+ * and decoder threads) and cached here: the hot path only reads the
+ * cached values, that are consistent for all the messages of a block.
+ *
+ * Every thread refreshes the cache at its own pace and the fields are
+ * read without locks: a reader may see a value one tick old, that is fine
+ * for time stamps with the resolution of a block.
+ *
+ * Frames are instead stamped with the index of their first sample since
+ * the start of the acquisition: the reader counts the samples of every
+ * block, the demodulator adds the offset of the frame inside the block.
+ * This is precise to half a microsecond, and the same at every replay of
+ * a file. */
+struct modesClock {
+    volatile time_t wall;           /* Wall clock, seconds. */
+    volatile long wall_ms;          /* Wall clock, milliseconds. */
+    volatile long mono_ms;          /* Monotonic clock, milliseconds. */
+    uint64_t samples;               /* Samples up to the end of the last block. */
+    long sample0_ms;                /* Wall clock of the sample 0. */
+};
+
+ /* Read the clocks and cache them. */
+ void modesClockTick(void);
+
+ /* Cached wall clock in seconds, like time(NULL). */
+ time_t modesClockSec(void);
+
+ /* Cached wall clock in milliseconds. */
+ long modesClockMs(void);
+
+ /* Cached monotonic clock in milliseconds, for timeouts and intervals. */
+ long modesClockMonoMs(void);
+
+ /* Count 'n' more samples read, called by the reader for every block. */
+ void modesClockAdvance(uint32_t n);
+
+ /* Wall clock in milliseconds of a sample counter time stamp. */
+ long modesSampleToMs(uint64_t t);
+
+ /* Write a time stamp in decimal, in at most MODES_TIME_STR_LEN bytes.
+  * Returns the number of digits. */
+ int modesFormatTime(char *buf, uint64_t t);
+
+ /* Parse a decimal time stamp, stopping at the first non digit. */
+ uint64_t modesParseTime(const char *s);
+
+} // namespace
+
+#endif
@@ -10,7 +10,8 @@
 extern "C" {
 #include <pthread.h>
 #include <unistd.h>
-#include <sys/times.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 }
 
 namespace modesDecode {
@@ -44,12 +45,26 @@ void modesInitConfig(void) {
     Modes.net_output_raw_port = MODES_NET_OUTPUT_RAW_PORT;
     Modes.net_input_raw_port = MODES_NET_INPUT_RAW_PORT;
     Modes.net_http_port = MODES_NET_HTTP_PORT;
+    Modes.push = NULL;
+    Modes.push_count = 0;
+    Modes.udp.fd = -1;
+    Modes.udp.count = 0;
+    Modes.udp.dest = NULL;
+    Modes.udp.ttl = MODES_NET_UDP_TTL;
+    Modes.udp.len = 0;
+    Modes.udp.seq = 0;
+    Modes.udp.stat_datagrams = 0;
+    Modes.udp.stat_errors = 0;
     Modes.onlyaddr = 0;
     Modes.debug = 0;
     Modes.interactive = 0;
     Modes.interactive_rows = MODES_INTERACTIVE_ROWS;
     Modes.interactive_ttl = MODES_INTERACTIVE_TTL;
+    Modes.max_aircrafts = MODES_MAX_AIRCRAFTS;
+    Modes.icao_cache_len = MODES_ICAO_CACHE_LEN;
     Modes.aggressive = 0;
+    Modes.squelch = 1;
+    Modes.profile = MODES_PROFILE_DEFAULT;
 }
 
 void modesInit(void) {
@@ -57,6 +72,9 @@ void modesInit(void) {
 
     ::pthread_mutex_init(&Modes.data_mutex,NULL);
     ::pthread_cond_init(&Modes.data_cond,NULL);
+    ::pthread_mutex_init(&Modes.icao_mutex,NULL);
+    ::pthread_mutex_init(&Modes.clients_mutex,NULL);
+    ::pthread_mutex_init(&Modes.aircrafts_mutex,NULL);
     /* We add a full message minus a final bit to the length, so that we
      * can carry the remaining part of the buffer that we can't process
      * in the message detection loop, back at the start of the next data
@@ -64,15 +82,28 @@ void modesInit(void) {
      * two reads. */
     Modes.data_len = MODES_DATA_LEN + (MODES_FULL_LEN-1)*4;
     Modes.data_ready = 0;
-    Modes.time = ::times(&Modes.cpu_time);
-    /* Allocate the ICAO address cache. We use two uint32_t for every
-     * entry because it's a addr / timestamp pair for every entry. */
-    Modes.icao_cache = (uint32_t*)::malloc(sizeof(uint32_t)*MODES_ICAO_CACHE_LEN*2);
-    ::memset(Modes.icao_cache,0,sizeof(uint32_t)*MODES_ICAO_CACHE_LEN*2);
+    modeSMessage::modesClockTick();
+    /* The first samples of the first block are the (empty) part carried
+     * over from the previous one. */
+    Modes.clock.samples = (MODES_FULL_LEN-1)*2;
+    Modes.clock.sample0_ms = 0;
+    /* Allocate the ICAO address cache. */
+    Modes.icao_cache = (struct icaoCacheEntry*)
+      ::calloc(Modes.icao_cache_len, sizeof(struct icaoCacheEntry));
     Modes.aircrafts = NULL;
-    Modes.interactive_last_update = modeSMessage::mstime();
+    Modes.lru_head = Modes.lru_tail = NULL;
+    ::memset(&Modes.aircraft_pool, 0, sizeof(Modes.aircraft_pool));
+    ::memset(Modes.expiry, 0, sizeof(Modes.expiry));
+    ::memset(Modes.probation, 0, sizeof(Modes.probation));
+    Modes.expiry_time = modeSMessage::modesClockSec();
+    Modes.rawoutlen = 0;
+    Modes.sbsoutlen = 0;
+    Modes.interactive_last_update = modeSMessage::modesClockMonoMs();
+    /* One more window max, always loud, past the end of the vector. */
     if ((Modes.data = (unsigned char*)::malloc(Modes.data_len)) == NULL ||
-        (Modes.magnitude = (uint16_t*)::malloc(Modes.data_len*2)) == NULL) {
+        (Modes.magnitude = (uint16_t*)::malloc(Modes.data_len*2)) == NULL ||
+        (Modes.window_max = (uint16_t*)::malloc(
+           ((Modes.data_len/2 >> MODES_SQUELCH_SHIFT) + 2)*2)) == NULL) {
       ::fprintf(stderr, "Out of memory allocating data buffer.\n");
       ::exit(1);
     }
@@ -92,6 +123,18 @@ void modesInit(void) {
       }
     }
 
+    /* The low-power profile uses a table with just the 8 most significant
+     * bits of the magnitude: half the size of the full table (16k instead
+     * of 33k), it stays in the first level cache of small CPUs. */
+    Modes.maglut8 = NULL;
+    if (Modes.profile == MODES_PROFILE_LOW_POWER) {
+      if ((Modes.maglut8 = (uint8_t*)::malloc(129*129)) == NULL) {
+        ::fprintf(stderr, "Out of memory allocating data buffer.\n");
+        ::exit(1);
+      }
+      for (i = 0; i < 129*129; i++) Modes.maglut8[i] = Modes.maglut[i] >> 8;
+    }
+
     /* Statistics */
     Modes.stat_valid_preamble = 0;
     Modes.stat_demodulated = 0;
@@ -103,6 +146,22 @@ void modesInit(void) {
     Modes.stat_http_requests = 0;
     Modes.stat_sbs_connections = 0;
     Modes.stat_out_of_phase = 0;
+    Modes.stat_admitted = 0;
+    Modes.stat_probation = 0;
+    Modes.stat_rejected = 0;
+    Modes.stat_evicted = 0;
+    Modes.stat_icao_hits = 0;
+    Modes.stat_icao_misses = 0;
+    Modes.stat_icao_evictions = 0;
+    Modes.stat_signal_sum = 0;
+    Modes.stat_signal_count = 0;
+    Modes.stat_signal_peak = 0;
+    Modes.noise_level = 0;
+    Modes.noise_floor = 0;
+    Modes.stat_squelch_windows = 0;
+    Modes.stat_squelch_skipped = 0;
+    Modes.stat_soft_fix = 0;
+    Modes.stat_ap_fix = 0;
     Modes.exit = 0;
 }
 
@@ -175,8 +234,9 @@ void modesInitRTLSDR(void) {
 void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
   (void)ctx;
   ::pthread_mutex_lock(&Modes.data_mutex);
-  Modes.time = ::times(&Modes.cpu_time);
+  modeSMessage::modesClockTick();
   if (len > MODES_DATA_LEN) len = MODES_DATA_LEN;
+  modeSMessage::modesClockAdvance(len/2);
   /* Move the last part of the previous buffer, that was not processed,
    * on the start of the new buffer. */
   ::memcpy(Modes.data, Modes.data+MODES_DATA_LEN, (MODES_FULL_LEN-1)*4);
@@ -233,10 +293,14 @@ void readBinaryDataFromFile(void) {
              * no signal. */
             ::memset(p,127,toread);
         }
+        modeSMessage::modesClockTick();
+        modeSMessage::modesClockAdvance(MODES_DATA_LEN/2);
         Modes.data_ready = 1;
         /* Signal to the other thread that new data is ready */
         ::pthread_cond_signal(&Modes.data_cond);
+        if (Modes.exit) break; /* That was the last block. */
     }
+    ::pthread_mutex_unlock(&Modes.data_mutex);
 }
 
 
@@ -312,7 +376,7 @@ uint32_t modesChecksum(unsigned char *msg, int bits) {
 
 /* Produce a raw representation of the message as a Javascript file
  * loadable by debug.html. */
-void dumpRawMessageJS(const clock_t *time, char *descr, unsigned char *msg,
+void dumpRawMessageJS(const uint64_t *time, char *descr, unsigned char *msg,
                       uint16_t *m, uint32_t offset, int fixable)
 {
     int padding = 5; /* Show a few samples before the actual start. */
@@ -320,6 +384,7 @@ void dumpRawMessageJS(const clock_t *time, char *descr, unsigned char *msg,
     int end = offset + (MODES_PREAMBLE_US*2)+
       (MODES_LONG_MSG_BITS*2) - 1;
     FILE *fp;
+    char stamp[MODES_TIME_STR_LEN];
     int j, fix1 = -1, fix2 = -1;
 
     if (fixable != -1) {
@@ -332,7 +397,8 @@ void dumpRawMessageJS(const clock_t *time, char *descr, unsigned char *msg,
         exit(1);
     }
 
-    ::fprintf(fp,"frames.push({\"time\": \"%ld\", \"descr\": \"%s\", \"mag\": [", *time, descr);
+    modeSMessage::modesFormatTime(stamp, *time);
+    ::fprintf(fp,"frames.push({\"time\": \"%s\", \"descr\": \"%s\", \"mag\": [", stamp, descr);
     for (j = start; j <= end; j++) {
         ::fprintf(fp,"%d", j < 0 ? 0 : m[j]);
         if (j != end) ::fprintf(fp,",");
@@ -486,9 +552,10 @@ void dumpMagnitudeVector(uint16_t *m, uint32_t offset) {
  * display packets in a graphical format if the Javascript output was
  * enabled.
  */
-void dumpRawMessage(const clock_t *time, char *descr, unsigned char *msg,
+void dumpRawMessage(const uint64_t *time, char *descr, unsigned char *msg,
                     uint16_t *m, uint32_t offset)
 {
+    char stamp[MODES_TIME_STR_LEN];
     int j;
     int msgtype = msg[0]>>3;
     int fixable = -1;
@@ -506,7 +573,8 @@ void dumpRawMessage(const clock_t *time, char *descr, unsigned char *msg,
         return;
     }
 
-    ::printf("\n---%ld %s\n    ", *time, descr);
+    modeSMessage::modesFormatTime(stamp, *time);
+    ::printf("\n---%s %s\n    ", stamp, descr);
     for (j = 0; j < MODES_LONG_MSG_BYTES; j++) {
         ::printf("%02x",msg[j]);
         if (j == MODES_SHORT_MSG_BYTES-1) ::printf(" ... ");
@@ -519,35 +587,169 @@ void dumpRawMessage(const clock_t *time, char *descr, unsigned char *msg,
 
 
 
-/* Hash the ICAO address to index our cache of MODES_ICAO_CACHE_LEN
+/* Hash the ICAO address to index a set of our cache of Modes.icao_cache_len
  * elements, that is assumed to be a power of two. */
-uint32_t ICAOCacheHashAddress(uint32_t a) {
+static struct icaoCacheEntry *ICAOCacheSet(uint32_t a) {
     /* The following three rounds wil make sure that every bit affects
      * every output bit with ~ 50% of probability. */
     a = ((a >> 16) ^ a) * 0x45d9f3b;
     a = ((a >> 16) ^ a) * 0x45d9f3b;
     a = ((a >> 16) ^ a);
-    return a & (MODES_ICAO_CACHE_LEN-1);
+    a &= Modes.icao_cache_len/MODES_ICAO_CACHE_WAYS - 1;
+    return Modes.icao_cache + a*MODES_ICAO_CACHE_WAYS;
+}
+
+/* Move the entry 'w' of the set in front of it, the set is kept sorted from
+ * the most to the least recently used. */
+static void ICAOCacheMoveToFront(struct icaoCacheEntry *set, int w) {
+    struct icaoCacheEntry e = set[w];
+
+    for (; w > 0; w--) set[w] = set[w-1];
+    set[0] = e;
+}
+
+static int ICAOCacheEntryIsFresh(struct icaoCacheEntry *e) {
+    return e->addr &&
+           (uint32_t)modeSMessage::modesClockSec() - e->seen <= MODES_ICAO_CACHE_TTL;
 }
 
 /* Add the specified entry to the cache of recently seen ICAO addresses.
  * Note that we also add a timestamp so that we can make sure that the
- * entry is only valid for MODES_ICAO_CACHE_TTL seconds. */
+ * entry is only valid for MODES_ICAO_CACHE_TTL seconds.
+ *
+ * The cache is MODES_ICAO_CACHE_WAYS ways set associative: an address
+ * replaces the least recently used entry of its set, and only if no entry
+ * of the set is free or expired. */
 void addRecentlySeenICAOAddr(uint32_t addr) {
-    uint32_t h = ICAOCacheHashAddress(addr);
-    Modes.icao_cache[h*2] = addr;
-    Modes.icao_cache[h*2+1] = (uint32_t) time(NULL);
+    struct icaoCacheEntry *set;
+    int w;
+
+    ::pthread_mutex_lock(&Modes.icao_mutex);
+    set = ICAOCacheSet(addr);
+    for (w = 0; w < MODES_ICAO_CACHE_WAYS; w++) {
+        if (set[w].addr == addr) break;
+    }
+    if (w == MODES_ICAO_CACHE_WAYS) {
+        /* Take the first empty or expired entry, otherwise evict the least
+         * recently used one, the last of the set. */
+        for (w = 0; w < MODES_ICAO_CACHE_WAYS; w++)
+            if (!ICAOCacheEntryIsFresh(&set[w])) break;
+        if (w == MODES_ICAO_CACHE_WAYS) {
+            w = MODES_ICAO_CACHE_WAYS-1;
+            Modes.stat_icao_evictions++;
+        }
+        set[w].addr = addr;
+    }
+    set[w].seen = (uint32_t)modeSMessage::modesClockSec();
+    ICAOCacheMoveToFront(set, w);
+    ::pthread_mutex_unlock(&Modes.icao_mutex);
+}
+
+/* Same as ICAOAddressWasRecentlySeen() without statistics and LRU update,
+ * for the error correction lookups. Called with icao_mutex held. */
+static int ICAOCacheLookup(uint32_t addr) {
+    struct icaoCacheEntry *set = ICAOCacheSet(addr);
+    int w;
+
+    for (w = 0; w < MODES_ICAO_CACHE_WAYS; w++)
+        if (set[w].addr == addr) return ICAOCacheEntryIsFresh(&set[w]);
+    return 0;
 }
 
 /* Returns 1 if the specified ICAO address was seen in a DF format with
  * proper checksum (not xored with address) no more than * MODES_ICAO_CACHE_TTL
  * seconds ago. Otherwise returns 0. */
 int ICAOAddressWasRecentlySeen(uint32_t addr) {
-    uint32_t h = ICAOCacheHashAddress(addr);
-    uint32_t a = Modes.icao_cache[h*2];
-    uint32_t t = Modes.icao_cache[h*2+1];
+    struct icaoCacheEntry *set;
+    int w, found = 0;
+
+    /* The demodulator, the network thread and the decoder thread all use
+     * the cache. */
+    ::pthread_mutex_lock(&Modes.icao_mutex);
+    set = ICAOCacheSet(addr);
+    for (w = 0; w < MODES_ICAO_CACHE_WAYS; w++) {
+        if (set[w].addr == addr) {
+            found = ICAOCacheEntryIsFresh(&set[w]);
+            if (found) ICAOCacheMoveToFront(set, w);
+            break;
+        }
+    }
+    if (found)
+        Modes.stat_icao_hits++;
+    else
+        Modes.stat_icao_misses++;
+    ::pthread_mutex_unlock(&Modes.icao_mutex);
+    return found;
+}
+
+void ICAOCacheShowStats(void) {
+    long lookups = Modes.stat_icao_hits + Modes.stat_icao_misses;
 
-    return a && (a == addr) && (time(NULL)-t <= MODES_ICAO_CACHE_TTL);
+    ::printf("ICAO cache: %d entries, %ld hits, %ld misses (%.1f%% hits), "
+             "%ld evictions\n", Modes.icao_cache_len, Modes.stat_icao_hits,
+             Modes.stat_icao_misses,
+             lookups ? 100.0*Modes.stat_icao_hits/lookups : 0.0,
+             Modes.stat_icao_evictions);
+}
+
+/* Return true if the DF has the checksum xored with the ICAO address. */
+static int isAPFormat(int msgtype) {
+    return msgtype == 0 ||      /* Short air surveillance */
+           msgtype == 4 ||      /* Surveillance, altitude reply */
+           msgtype == 5 ||      /* Surveillance, identity reply */
+           msgtype == 16 ||     /* Long Air-Air survillance */
+           msgtype == 20 ||     /* Comm-A, altitude request */
+           msgtype == 21 ||     /* Comm-A, identity request */
+           msgtype == 24;       /* Comm-C ELM */
+}
+
+/* Syndrome of the bit 'j' of a message of 'bits' bits: how flipping it
+ * changes the CRC field xored with the computed checksum. */
+static uint32_t bitSyndrome(int j, int bits) {
+    if (j >= bits-24) return 1 << (bits-1-j); /* CRC field. */
+    return modes_checksum_table[j + (bits == 112 ? 0 : 112-56)];
+}
+
+/* Fix a single bit error in a message with the AP field, after
+ * bruteForceAP() failed. 'syndrome' is the AP field xored with the
+ * computed checksum: if bit 'j' is wrong, the address is
+ * syndrome ^ bitSyndrome(j), so every bit of the message costs a lookup
+ * in the ICAO cache. The fix is accepted only if exactly one bit leads to
+ * a recently seen address, otherwise we can't tell which one is right.
+ * The DF bits are not tried, a flip there would change the format.
+ *
+ * On success the bit is flipped in 'msg', the address stored in mm as
+ * bruteForceAP() does, mm->errorbit set to the bit, and 1 returned.
+ * Otherwise 0 is returned. */
+static int fixAPSingleBitError(unsigned char *msg,
+                               struct modeSMessage::modesMessage *mm,
+                               uint32_t syndrome) {
+    uint32_t addr = 0;
+    int j, bit = -1;
+
+    ::pthread_mutex_lock(&Modes.icao_mutex);
+    for (j = MODES_DF_BITS; j < mm->msgbits; j++) {
+        uint32_t a = syndrome ^ bitSyndrome(j, mm->msgbits);
+
+        if (ICAOCacheLookup(a)) {
+            if (bit != -1) {
+                bit = -1;       /* Ambiguous. */
+                break;
+            }
+            bit = j;
+            addr = a;
+        }
+    }
+    ::pthread_mutex_unlock(&Modes.icao_mutex);
+    if (bit == -1) return 0;
+
+    msg[bit/8] ^= 1 << (7-(bit%8));
+    mm->aa1 = addr >> 16;
+    mm->aa2 = (addr >> 8) & 0xff;
+    mm->aa3 = addr & 0xff;
+    mm->errorbit = bit;
+    mm->ap_fixed = 1;
+    return 1;
 }
 
 /* If the message type has the checksum xored with the ICAO address, try to
@@ -570,14 +772,7 @@ int ICAOAddressWasRecentlySeen(uint32_t addr) {
     int msgtype = mm->msgtype;
     int msgbits = mm->msgbits;
 
-    if (msgtype == 0 ||         /* Short air surveillance */
-        msgtype == 4 ||         /* Surveillance, altitude reply */
-        msgtype == 5 ||         /* Surveillance, identity reply */
-        msgtype == 16 ||        /* Long Air-Air survillance */
-        msgtype == 20 ||        /* Comm-A, altitude request */
-        msgtype == 21 ||        /* Comm-A, identity request */
-        msgtype == 24)          /* Comm-C ELM */
-    {
+    if (isAPFormat(msgtype)) {
         uint32_t addr;
         uint32_t crc;
         int lastbyte = (msgbits/8)-1;
@@ -706,13 +901,24 @@ char *getMEDescription(int metype, int mesub) {
     return mename;
 }
 
-/* Decode a raw Mode S message demodulated as a stream of bytes by
- * detectModeS(), and split it into fields populating a modesMessage
- * structure. */
+static int softFixErrors(struct modeSMessage::modesMessage *mm, uint16_t *p,
+                         int corrected, uint32_t syndrome, int ap);
+
+/* Decode the header of a raw Mode S message demodulated as a stream of
+ * bytes by detectModeS(): DF, length, CRC (fixing errors when possible)
+ * and ICAO address. The remaining fields are decoded on demand by
+ * decodeModesFields(). */
  void decodeModesMessage(struct modeSMessage::modesMessage *mm, unsigned char *msg) {
+    decodeModesMessageSoft(mm, msg, NULL, 0);
+}
+
+ void decodeModesMessageSoft(struct modeSMessage::modesMessage *mm,
+                             unsigned char *msg, uint16_t *p, int corrected) {
     uint32_t crc2;   /* Computed CRC, used to verify the message CRC. */
-    char *ais_charset = 
-      (char*)"?ABCDEFGHIJKLMNOPQRSTUVWXYZ????? ???????????????0123456789??????";
+
+    /* The weak bits flips and the AP single bit fix, that need 'p', are
+     * the first work shed under load (see modesLoad.h). */
+    if (Modes.load.level >= MODES_LOAD_NO_SOFT_FIX) p = NULL;
 
     /* Work on our local copy */
     ::memcpy(mm->msg,msg,MODES_LONG_MSG_BYTES);
@@ -731,6 +937,8 @@ char *getMEDescription(int metype, int mesub) {
     /* Check CRC and fix single bit errors using the CRC when
      * possible (DF 11 and 17). */
     mm->errorbit = -1;  /* No error */
+    mm->flipped = 0;
+    mm->ap_fixed = 0;
     mm->crcok = (mm->crc == crc2);
 
     if (!mm->crcok && Modes.fix_errors &&
@@ -739,7 +947,12 @@ char *getMEDescription(int metype, int mesub) {
         if ((mm->errorbit = fixSingleBitErrors(msg,mm->msgbits)) != -1) {
             mm->crc = modesChecksum(msg,mm->msgbits);
             mm->crcok = 1;
+        } else if (p && Modes.profile != MODES_PROFILE_LOW_POWER &&
+                   softFixErrors(mm,p,corrected,mm->crc ^ crc2,0)) {
+            mm->crc = modesChecksum(msg,mm->msgbits);
+            mm->crcok = 1;
         } else if (Modes.aggressive && mm->msgtype == 17 &&
+                   Modes.load.level < MODES_LOAD_NO_TWO_BITS &&
                    (mm->errorbit = fixTwoBitsErrors(msg,mm->msgbits)) != -1)
         {
             mm->crc = modesChecksum(msg,mm->msgbits);
@@ -747,57 +960,15 @@ char *getMEDescription(int metype, int mesub) {
         }
     }
 
-    /* Note that most of the other computation happens *after* we fix
-     * the single bit errors, otherwise we would need to recompute the
-     * fields again. */
-    mm->ca = msg[0] & 7;        /* Responder capabilities. */
+    /* Note that the address and all the other fields are extracted
+     * *after* we fix the single bit errors, otherwise we would need to
+     * recompute them again. */
 
     /* ICAO address */
     mm->aa1 = msg[1];
     mm->aa2 = msg[2];
     mm->aa3 = msg[3];
 
-    /* DF 17 type (assuming this is a DF17, otherwise not used) */
-    mm->metype = msg[4] >> 3;   /* Extended squitter message type. */
-    mm->mesub = msg[4] & 7;     /* Extended squitter message subtype. */
-
-    /* Fields for DF4,5,20,21 */
-    mm->fs = msg[0] & 7;        /* Flight status for DF4,5,20,21 */
-    mm->dr = msg[1] >> 3 & 31;  /* Request extraction of downlink request. */
-    mm->um = ((msg[1] & 7)<<3)| /* Request extraction of downlink request. */
-              msg[2]>>5;
-
-    /* In the squawk (identity) field bits are interleaved like that
-     * (message bit 20 to bit 32):
-     *
-     * C1-A1-C2-A2-C4-A4-ZERO-B1-D1-B2-D2-B4-D4
-     *
-     * So every group of three bits A, B, C, D represent an integer
-     * from 0 to 7.
-     *
-     * The actual meaning is just 4 octal numbers, but we convert it
-     * into a base ten number tha happens to represent the four
-     * octal numbers.
-     *
-     * For more info: http://en.wikipedia.org/wiki/Gillham_code */
-    {
-        int a,b,c,d;
-
-        a = ((msg[3] & 0x80) >> 5) |
-            ((msg[2] & 0x02) >> 0) |
-            ((msg[2] & 0x08) >> 3);
-        b = ((msg[3] & 0x02) << 1) |
-            ((msg[3] & 0x08) >> 2) |
-            ((msg[3] & 0x20) >> 5);
-        c = ((msg[2] & 0x01) << 2) |
-            ((msg[2] & 0x04) >> 1) |
-            ((msg[2] & 0x10) >> 4);
-        d = ((msg[3] & 0x01) << 2) |
-            ((msg[3] & 0x04) >> 1) |
-            ((msg[3] & 0x10) >> 4);
-        mm->identity = a*1000 + b*100 + c*10 + d;
-    }
-
     /* DF 11 & 17: try to populate our ICAO addresses whitelist.
      * DFs with an AP field (xored addr and crc), try to decode it. */
     if (mm->msgtype != 11 && mm->msgtype != 17) {
@@ -807,6 +978,13 @@ char *getMEDescription(int metype, int mesub) {
         if (bruteForceAP(msg,mm)) {
             /* We recovered the message, mark the checksum as valid. */
             mm->crcok = 1;
+        } else if (p && Modes.fix_errors && isAPFormat(mm->msgtype) &&
+                   fixAPSingleBitError(msg,mm,mm->crc ^ crc2)) {
+            mm->crcok = 1;
+        } else if (p && Modes.fix_errors && isAPFormat(mm->msgtype) &&
+                   Modes.profile != MODES_PROFILE_LOW_POWER &&
+                   softFixErrors(mm,p,corrected,mm->crc ^ crc2,1)) {
+            mm->crcok = 1;
         } else {
             mm->crcok = 0;
         }
@@ -820,82 +998,148 @@ char *getMEDescription(int metype, int mesub) {
         }
     }
 
+    mm->phase_corrected = 0; /* Set to 1 by the caller if needed. */
+    mm->signal = 0;          /* Set by the demodulator. */
+    mm->decoded = 0;         /* Fields are decoded on demand. */
+    mm->unit = MODES_UNIT_FEET;
+}
+
+/* Split a message whose header was decoded by decodeModesMessage() into
+ * the fields relevant for its DF (and ME type for DF17). Only consumers
+ * that need the fields call this (tracking, SBS and human readable
+ * output), so raw output and relaying never pay for it. Calling it more
+ * than once is harmless. */
+void decodeModesFields(struct modeSMessage::modesMessage *mm) {
+    unsigned char *msg = mm->msg;
+    char *ais_charset = 
+      (char*)"?ABCDEFGHIJKLMNOPQRSTUVWXYZ????? ???????????????0123456789??????";
+    int unit = mm->unit;
+
+    if (mm->decoded) return;
+    mm->decoded = 1;
+
+    mm->ca = msg[0] & 7;        /* Responder capabilities. */
+    mm->fs = msg[0] & 7;        /* Flight status for DF4,5,20,21 */
+
+    /* Fields for DF4,5,20,21 */
+    if (mm->msgtype == 4 || mm->msgtype == 5 ||
+        mm->msgtype == 20 || mm->msgtype == 21) {
+        mm->dr = msg[1] >> 3 & 31;  /* Request extraction of downlink request. */
+        mm->um = ((msg[1] & 7)<<3)| /* Request extraction of downlink request. */
+                  msg[2]>>5;
+
+        /* In the squawk (identity) field bits are interleaved like that
+         * (message bit 20 to bit 32):
+         *
+         * C1-A1-C2-A2-C4-A4-ZERO-B1-D1-B2-D2-B4-D4
+         *
+         * So every group of three bits A, B, C, D represent an integer
+         * from 0 to 7.
+         *
+         * The actual meaning is just 4 octal numbers, but we convert it
+         * into a base ten number tha happens to represent the four
+         * octal numbers.
+         *
+         * For more info: http://en.wikipedia.org/wiki/Gillham_code */
+        int a,b,c,d;
+
+        a = ((msg[3] & 0x80) >> 5) |
+            ((msg[2] & 0x02) >> 0) |
+            ((msg[2] & 0x08) >> 3);
+        b = ((msg[3] & 0x02) << 1) |
+            ((msg[3] & 0x08) >> 2) |
+            ((msg[3] & 0x20) >> 5);
+        c = ((msg[2] & 0x01) << 2) |
+            ((msg[2] & 0x04) >> 1) |
+            ((msg[2] & 0x10) >> 4);
+        d = ((msg[3] & 0x01) << 2) |
+            ((msg[3] & 0x04) >> 1) |
+            ((msg[3] & 0x10) >> 4);
+        mm->identity = a*1000 + b*100 + c*10 + d;
+    }
+
     /* Decode 13 bit altitude for DF0, DF4, DF16, DF20 */
     if (mm->msgtype == 0 || mm->msgtype == 4 ||
         mm->msgtype == 16 || mm->msgtype == 20) {
-        mm->altitude = decodeAC13Field(msg, &mm->unit);
+        mm->altitude = decodeAC13Field(msg, &unit);
+        mm->unit = unit;
     }
 
     /* Decode extended squitter specific stuff. */
     if (mm->msgtype == 17) {
+        /* DF 17 type */
+        mm->metype = msg[4] >> 3;   /* Extended squitter message type. */
+        mm->mesub = msg[4] & 7;     /* Extended squitter message subtype. */
+
         /* Decode the extended squitter message. */
 
         if (mm->metype >= 1 && mm->metype <= 4) {
             /* Aircraft Identification and Category */
-            mm->aircraft_type = mm->metype-1;
-            mm->flight[0] = ais_charset[msg[5]>>2];
-            mm->flight[1] = ais_charset[((msg[5]&3)<<4)|(msg[6]>>4)];
-            mm->flight[2] = ais_charset[((msg[6]&15)<<2)|(msg[7]>>6)];
-            mm->flight[3] = ais_charset[msg[7]&63];
-            mm->flight[4] = ais_charset[msg[8]>>2];
-            mm->flight[5] = ais_charset[((msg[8]&3)<<4)|(msg[9]>>4)];
-            mm->flight[6] = ais_charset[((msg[9]&15)<<2)|(msg[10]>>6)];
-            mm->flight[7] = ais_charset[msg[10]&63];
-            mm->flight[8] = '\0';
+            mm->me.ident.aircraft_type = mm->metype-1;
+            mm->me.ident.flight[0] = ais_charset[msg[5]>>2];
+            mm->me.ident.flight[1] = ais_charset[((msg[5]&3)<<4)|(msg[6]>>4)];
+            mm->me.ident.flight[2] = ais_charset[((msg[6]&15)<<2)|(msg[7]>>6)];
+            mm->me.ident.flight[3] = ais_charset[msg[7]&63];
+            mm->me.ident.flight[4] = ais_charset[msg[8]>>2];
+            mm->me.ident.flight[5] = ais_charset[((msg[8]&3)<<4)|(msg[9]>>4)];
+            mm->me.ident.flight[6] = ais_charset[((msg[9]&15)<<2)|(msg[10]>>6)];
+            mm->me.ident.flight[7] = ais_charset[msg[10]&63];
+            mm->me.ident.flight[8] = '\0';
         } else if (mm->metype >= 9 && mm->metype <= 18) {
             /* Airborne position Message */
-            mm->fflag = msg[6] & (1<<2);
-            mm->tflag = msg[6] & (1<<3);
-            mm->altitude = decodeAC12Field(msg,&mm->unit);
-            mm->raw_latitude = ((msg[6] & 3) << 15) |
+            mm->me.pos.fflag = msg[6] & (1<<2);
+            mm->me.pos.tflag = msg[6] & (1<<3);
+            mm->altitude = decodeAC12Field(msg,&unit);
+            mm->unit = unit;
+            mm->me.pos.raw_latitude = ((msg[6] & 3) << 15) |
                                 (msg[7] << 7) |
                                 (msg[8] >> 1);
-            mm->raw_longitude = ((msg[8]&1) << 16) |
+            mm->me.pos.raw_longitude = ((msg[8]&1) << 16) |
                                  (msg[9] << 8) |
                                  msg[10];
         } else if (mm->metype == 19 && mm->mesub >= 1 && mm->mesub <= 4) {
             /* Airborne Velocity Message */
             if (mm->mesub == 1 || mm->mesub == 2) {
-                mm->ew_dir = (msg[5]&4) >> 2;
-                mm->ew_velocity = ((msg[5]&3) << 8) | msg[6];
-                mm->ns_dir = (msg[7]&0x80) >> 7;
-                mm->ns_velocity = ((msg[7]&0x7f) << 3) | ((msg[8]&0xe0) >> 5);
-                mm->vert_rate_source = (msg[8]&0x10) >> 4;
-                mm->vert_rate_sign = (msg[8]&0x8) >> 5;
-                mm->vert_rate = ((msg[8]&7) << 6) | ((msg[9]&0xfc) >> 2);
+                mm->me.vel.ew_dir = (msg[5]&4) >> 2;
+                mm->me.vel.ew_velocity = ((msg[5]&3) << 8) | msg[6];
+                mm->me.vel.ns_dir = (msg[7]&0x80) >> 7;
+                mm->me.vel.ns_velocity = ((msg[7]&0x7f) << 3) | ((msg[8]&0xe0) >> 5);
+                mm->me.vel.vert_rate_source = (msg[8]&0x10) >> 4;
+                mm->me.vel.vert_rate_sign = (msg[8]&0x8) >> 5;
+                mm->me.vel.vert_rate = ((msg[8]&7) << 6) | ((msg[9]&0xfc) >> 2);
                 /* Compute velocity and angle from the two speed
                  * components. */
-                mm->velocity = sqrt(mm->ns_velocity*mm->ns_velocity+
-                                    mm->ew_velocity*mm->ew_velocity);
-                if (mm->velocity) {
-                    int ewv = mm->ew_velocity;
-                    int nsv = mm->ns_velocity;
+                mm->me.vel.velocity = sqrt(mm->me.vel.ns_velocity*mm->me.vel.ns_velocity+
+                                    mm->me.vel.ew_velocity*mm->me.vel.ew_velocity);
+                if (mm->me.vel.velocity) {
+                    int ewv = mm->me.vel.ew_velocity;
+                    int nsv = mm->me.vel.ns_velocity;
                     double heading;
 
-                    if (mm->ew_dir) ewv *= -1;
-                    if (mm->ns_dir) nsv *= -1;
+                    if (mm->me.vel.ew_dir) ewv *= -1;
+                    if (mm->me.vel.ns_dir) nsv *= -1;
                     heading = atan2(ewv,nsv);
 
                     /* Convert to degrees. */
-                    mm->heading = heading * 360 / (M_PI*2);
+                    mm->me.vel.heading = heading * 360 / (M_PI*2);
                     /* We don't want negative values but a 0-360 scale. */
-                    if (mm->heading < 0) mm->heading += 360;
+                    if (mm->me.vel.heading < 0) mm->me.vel.heading += 360;
                 } else {
-                    mm->heading = 0;
+                    mm->me.vel.heading = 0;
                 }
             } else if (mm->mesub == 3 || mm->mesub == 4) {
-                mm->heading_is_valid = msg[5] & (1<<2);
-                mm->heading = (360.0/128) * (((msg[5] & 3) << 5) |
+                mm->me.vel.heading_is_valid = msg[5] & (1<<2);
+                mm->me.vel.heading = (360.0/128) * (((msg[5] & 3) << 5) |
                                               (msg[6] >> 3));
             }
         }
     }
-    mm->phase_corrected = 0; /* Set to 1 by the caller if needed. */
 }
 
 /* This function gets a decoded Mode S Message and prints it on the screen
  * in a human readable format. */
-void displayModesMessage(const clock_t *time, struct modeSMessage::modesMessage *mm) {
+void displayModesMessage(const uint64_t *time, struct modeSMessage::modesMessage *mm) {
+    char stamp[MODES_TIME_STR_LEN];
     int j;
 
     /* Handle only addresses mode first. */
@@ -907,17 +1151,22 @@ void displayModesMessage(const clock_t *time, struct modeSMessage::modesMessage
     // modeSMessage::sendSync(); // not thread save at the moment
 
     /* Show the raw message. */
-    ::printf("%ld*", *time);
+    modeSMessage::modesFormatTime(stamp, *time);
+    ::printf("%s*", stamp);
     for (j = 0; j < mm->msgbits/8; j++) ::printf("%02x", mm->msg[j]);
     ::printf(";\n");
 
-    if (Modes.raw) {
-        fflush(stdout); /* Provide data to the reader ASAP. */
-        return; /* Enough for --raw mode */
-    }
+    if (Modes.raw) return; /* Enough for --raw mode */
+
+    decodeModesFields(mm);
 
     ::printf("CRC: %06x (%s)\n", (int)mm->crc, mm->crcok ? "ok" : "wrong");
-    if (mm->errorbit != -1)
+    if (mm->flipped)
+        ::printf("%d weak bits fixed\n", mm->flipped);
+    else if (mm->ap_fixed)
+        ::printf("Single bit error fixed with the ICAO cache, bit %d\n",
+            mm->errorbit);
+    else if (mm->errorbit != -1)
         ::printf("Single bit error fixed, bit %d\n", mm->errorbit);
 
     if (mm->msgtype == 0) {
@@ -976,27 +1225,27 @@ void displayModesMessage(const clock_t *time, struct modeSMessage::modesMessage
                 (char*)"Aircraft Type A"
             };
 
-            ::printf("    Aircraft Type  : %s\n", ac_type_str[mm->aircraft_type]);
-            ::printf("    Identification : %s\n", mm->flight);
+            ::printf("    Aircraft Type  : %s\n", ac_type_str[mm->me.ident.aircraft_type]);
+            ::printf("    Identification : %s\n", mm->me.ident.flight);
         } else if (mm->metype >= 9 && mm->metype <= 18) {
-            ::printf("    F flag   : %s\n", mm->fflag ? "odd" : "even");
-            ::printf("    T flag   : %s\n", mm->tflag ? "UTC" : "non-UTC");
+            ::printf("    F flag   : %s\n", mm->me.pos.fflag ? "odd" : "even");
+            ::printf("    T flag   : %s\n", mm->me.pos.tflag ? "UTC" : "non-UTC");
             ::printf("    Altitude : %d feet\n", mm->altitude);
-            ::printf("    Latitude : %d (not decoded)\n", mm->raw_latitude);
-            ::printf("    Longitude: %d (not decoded)\n", mm->raw_longitude);
+            ::printf("    Latitude : %d (not decoded)\n", mm->me.pos.raw_latitude);
+            ::printf("    Longitude: %d (not decoded)\n", mm->me.pos.raw_longitude);
         } else if (mm->metype == 19 && mm->mesub >= 1 && mm->mesub <= 4) {
             if (mm->mesub == 1 || mm->mesub == 2) {
                 /* Velocity */
-                ::printf("    EW direction      : %d\n", mm->ew_dir);
-                ::printf("    EW velocity       : %d\n", mm->ew_velocity);
-                ::printf("    NS direction      : %d\n", mm->ns_dir);
-                ::printf("    NS velocity       : %d\n", mm->ns_velocity);
-                ::printf("    Vertical rate src : %d\n", mm->vert_rate_source);
-                ::printf("    Vertical rate sign: %d\n", mm->vert_rate_sign);
-                ::printf("    Vertical rate     : %d\n", mm->vert_rate);
+                ::printf("    EW direction      : %d\n", mm->me.vel.ew_dir);
+                ::printf("    EW velocity       : %d\n", mm->me.vel.ew_velocity);
+                ::printf("    NS direction      : %d\n", mm->me.vel.ns_dir);
+                ::printf("    NS velocity       : %d\n", mm->me.vel.ns_velocity);
+                ::printf("    Vertical rate src : %d\n", mm->me.vel.vert_rate_source);
+                ::printf("    Vertical rate sign: %d\n", mm->me.vel.vert_rate_sign);
+                ::printf("    Vertical rate     : %d\n", mm->me.vel.vert_rate);
             } else if (mm->mesub == 3 || mm->mesub == 4) {
-                ::printf("    Heading status: %d", mm->heading_is_valid);
-                ::printf("    Heading: %d", mm->heading);
+                ::printf("    Heading status: %d", mm->me.vel.heading_is_valid);
+                ::printf("    Heading: %d", mm->me.vel.heading);
             }
         } else {
             ::printf("    Unrecognized ME type: %d subtype: %d\n", 
@@ -1010,21 +1259,102 @@ void displayModesMessage(const clock_t *time, struct modeSMessage::modesMessage
     }
 }
 
+/* Estimate the noise floor of the block as the median magnitude of a
+ * subset of the samples: most of the samples are noise, and the median
+ * is not moved by the strong messages as the average would be. */
+static void computeNoiseFloor(uint16_t *m, uint32_t mlen) {
+    uint32_t hist[MODES_NOISE_BINS];
+    uint32_t j, count = 0, half;
+
+    ::memset(hist, 0, sizeof(hist));
+    for (j = 0; j < mlen; j += MODES_NOISE_DECIMATION) {
+        hist[m[j] >> 6]++;
+        count++;
+    }
+    half = count/2;
+    for (j = 0, count = 0; j < (uint32_t)MODES_NOISE_BINS-1; j++) {
+        count += hist[j];
+        if (count > half) break;
+    }
+    Modes.noise_level = (j << 6) + 32;
+    Modes.noise_floor = Modes.noise_floor ?
+      (Modes.noise_floor*7 + Modes.noise_level)/8 : Modes.noise_level;
+}
+
+/* Convert a magnitude to dBFS, 0 dBFS being a full scale I or Q sample. */
+double signalToDbfs(int level) {
+    if (level <= 0) level = 1;
+    return 20*::log10((double)level/MODES_SIGNAL_FULL_SCALE);
+}
+
+void signalShowStats(void) {
+    if (Modes.stat_signal_count)
+        ::printf("signal average %.1f dBFS, peak %.1f dBFS, ",
+                 signalToDbfs(Modes.stat_signal_sum/Modes.stat_signal_count),
+                 signalToDbfs(Modes.stat_signal_peak));
+    ::printf("noise floor %.1f dBFS\n", signalToDbfs(Modes.noise_floor));
+}
+
+void squelchShowStats(void) {
+    ::printf("%ld of %ld squelch windows skipped (%.1f%%)\n",
+             Modes.stat_squelch_skipped, Modes.stat_squelch_windows,
+             Modes.stat_squelch_windows ?
+               100.0*Modes.stat_squelch_skipped/Modes.stat_squelch_windows :
+               0.0);
+}
+
+void profileShowStats(void) {
+    static const char *names[] = {"default", "low-power", "max-decode"};
+    struct rusage ru;
+    long usable = Modes.stat_goodcrc + Modes.stat_fixed;
+    double signal = (double)Modes.clock.samples/MODES_DEFAULT_RATE;
+    double cpu;
+
+    /* Includes the reader and decoder threads, and the start up. */
+    ::getrusage(RUSAGE_SELF, &ru);
+    cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+          ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+    ::printf("profile %s: %.1f usable messages per second of signal, "
+             "CPU %.3f s for %.1f s of signal (%.1f%%), %.1f us per message\n",
+             names[Modes.profile], signal > 0 ? usable/signal : 0.0,
+             cpu, signal, signal > 0 ? 100.0*cpu/signal : 0.0,
+             usable ? 1e6*cpu/usable : 0.0);
+}
+
 void computeMagnitudeVector(void) {
     uint16_t *m = Modes.magnitude;
     unsigned char *p = Modes.data;
-    uint32_t j;
+    uint32_t mlen = Modes.data_len/2, j, k;
 
     /* Compute the magnitudo vector. It's just SQRT(I^2 + Q^2), but
-     * we rescale to the 0-255 range to exploit the full resolution. */
-    for (j = 0; j < Modes.data_len; j += 2) {
-        int i = p[j]-127;
-        int q = p[j+1]-127;
-
-        if (i < 0) i = -i;
-        if (q < 0) q = -q;
-        m[j/2] = Modes.maglut[i*129+q];
+     * we rescale to the 0-255 range to exploit the full resolution.
+     *
+     * While at it, take the max of every window of MODES_SQUELCH_WINDOW
+     * samples for the squelch of detectModeS(). */
+    for (j = 0; j < mlen; j = k) {
+        uint32_t end = j + MODES_SQUELCH_WINDOW;
+        uint16_t max = 0;
+
+        if (end > mlen) end = mlen;
+        for (k = j; k < end; k++) {
+            int i = p[k*2]-127;
+            int q = p[k*2+1]-127;
+
+            if (i < 0) i = -i;
+            if (q < 0) q = -q;
+            /* 8 bits magnitudes are scaled back to the 16 bits range the
+             * demodulator thresholds are tuned for. */
+            if (Modes.maglut8)
+                m[k] = Modes.maglut8[i*129+q] << 8;
+            else
+                m[k] = Modes.maglut[i*129+q];
+            if (m[k] > max) max = m[k];
+        }
+        Modes.window_max[j >> MODES_SQUELCH_SHIFT] = max;
     }
+    Modes.window_max[(mlen+MODES_SQUELCH_WINDOW-1) >> MODES_SQUELCH_SHIFT] =
+      0xffff;
+    computeNoiseFloor(m, mlen);
 }
 
 /* Return -1 if the message is out of fase left-side
@@ -1042,7 +1372,7 @@ int detectOutOfPhase(uint16_t *m) {
 }
 
 /* This function does not really correct the phase of the message, it just
- * applies a transformation to the first sample representing a given bit:
+ * returns a transformation of the first sample representing a given bit:
  *
  * If the previous bit was one, we amplify it a bit.
  * If the previous bit was zero, we decrease it a bit.
@@ -1069,30 +1399,183 @@ int detectOutOfPhase(uint16_t *m) {
  * it will be more likely to detect a one because of the transformation.
  * In this way similar levels will be interpreted more likely in the
  * correct way. */
-void applyPhaseCorrection(uint16_t *m) {
-    int j;
+static uint16_t phaseCorrectSample(int prev_one, uint16_t sample) {
+    /* Computed on 16 bits as when the correction was applied to the
+     * magnitude vector itself. */
+    return prev_one ? (uint16_t)((sample * 5) / 4) : (uint16_t)((sample * 4) / 5);
+}
 
-    m += 16; /* Skip preamble. */
-    for (j = 0; j < (MODES_LONG_MSG_BITS-1)*2; j += 2) {
-        if (m[j] > m[j+1]) {
-            /* One */
-            m[j+2] = (m[j+2] * 5) / 4;
-        } else {
-            /* Zero */
-            m[j+2] = (m[j+2] * 4) / 5;
+/* State of the bit slicer of a message. The bits are shifted in 'acc' as
+ * they are decided, and stored in 'msg' every eight bits, so the message
+ * is packed while it is sliced. */
+struct slicer {
+    unsigned char *msg;
+    int acc;
+    int bit;                        /* Last bit decided. */
+};
+
+/* Slice the first bit of a message from its two samples. Returns 1 if the
+ * two samples have the same magnitude: checking if two adiacent samples
+ * have the same magnitude is an effective way to detect if it's just
+ * random noise that was detected as a valid preamble. */
+static int sliceFirstBit(struct slicer *s, int low, int high) {
+    int error = low == high;
+
+    /* 2 marks the error, and it is shifted in the message as such, like
+     * the bits copied from it. */
+    s->bit = (low > high) | (error << 1);
+    s->acc = s->bit;
+    return error;
+}
+
+/* Slice the bit 'i' (not the first one) of a message from its two samples.
+ * When the two samples are too close the bit is the same as the previous
+ * one (that is always the case when they are equal, so there are no more
+ * errors after the first bit). No branches but the store of the bytes. */
+static void sliceBit(struct slicer *s, int i, int low, int high) {
+    int one = low > high;
+    int same = (unsigned)(low - high + 255) < 511; /* abs(delta) < 256 */
+
+    s->bit = one ^ ((one ^ s->bit) & -same);
+    s->acc = (s->acc << 1) | s->bit;
+    if ((i & 7) == 7) s->msg[i >> 3] = s->acc;
+}
+
+/* Soft decision error correction.
+ *
+ * The demodulator knows how reliable every bit is: the closer its two
+ * samples, the more likely the bit is wrong. When the checksum is wrong,
+ * instead of trying every bit of the message blindly, we try to flip the
+ * MODES_SOFT_BITS least reliable ones, up to MODES_SOFT_MAX_FLIPS at a
+ * time.
+ *
+ * The checksum is linear, so every bit has its own syndrome (the change of
+ * the CRC field xor the computed checksum when the bit is flipped) and a
+ * set of flips fixes the message if the xor of their syndromes is the
+ * syndrome of the message: every combination costs a few xors, not a
+ * checksum of the whole message. For the AP formats the syndrome is the
+ * address, and the fix is accepted if the address was recently seen; to
+ * limit the chances of matching a cached address by accident, fewer
+ * flips (MODES_SOFT_MAX_FLIPS_AP) are allowed. */
+
+/* Find the MODES_SOFT_BITS least reliable bits of the message from its
+ * samples, the same the demodulator sliced. The DF bits are never
+ * candidates: flipping them would change the format (and maybe the
+ * length) the message was decoded as. Returns how many were found,
+ * sorted from the least reliable. */
+static int findWeakBits(uint16_t *p, int corrected, int bits, int *pos) {
+    int rel[MODES_SOFT_BITS];
+    int low = p[0], n = 0, i, k;
+
+    for (i = 0; i < bits; i++) {
+        int high = p[i*2+1];
+        int r = (corrected ? low : p[i*2]) - high;
+
+        if (r < 0) r = -r;
+        if (i >= MODES_DF_BITS && (n < MODES_SOFT_BITS || r < rel[n-1])) {
+            /* Insert it keeping the list sorted. */
+            if (n < MODES_SOFT_BITS) n++;
+            for (k = n-1; k > 0 && rel[k-1] > r; k--) {
+                rel[k] = rel[k-1];
+                pos[k] = pos[k-1];
+            }
+            rel[k] = r;
+            pos[k] = i;
+        }
+        if (corrected && i < bits-1)
+            low = phaseCorrectSample(low > high, p[i*2+2]);
+    }
+    return n;
+}
+
+/* Check a set of flips: for DF11 / DF17 the syndrome must be cancelled,
+ * for the AP formats it must be a recently seen address. */
+static int softFixMatches(uint32_t syndrome, int ap) {
+    int found;
+
+    if (!ap) return syndrome == 0;
+    ::pthread_mutex_lock(&Modes.icao_mutex);
+    found = ICAOCacheLookup(syndrome);
+    ::pthread_mutex_unlock(&Modes.icao_mutex);
+    return found;
+}
+
+/* Try to fix the message flipping its weakest bits. On success the bits
+ * are flipped in mm->msg, mm->errorbit is the first bit flipped and
+ * mm->flipped how many bits; for the AP formats the address is stored in
+ * mm as bruteForceAP() does. Returns 1 on success, 0 otherwise. */
+static int softFixErrors(struct modeSMessage::modesMessage *mm, uint16_t *p,
+                         int corrected, uint32_t syndrome, int ap) {
+    int pos[MODES_SOFT_BITS];
+    uint32_t syn[MODES_SOFT_BITS];
+    int flips[3];
+    int maxflips = ap ? MODES_SOFT_MAX_FLIPS_AP : MODES_SOFT_MAX_FLIPS;
+    int n, a, b, c, k, nflips = 0;
+
+    n = findWeakBits(p, corrected, mm->msgbits, pos);
+    for (k = 0; k < n; k++) syn[k] = bitSyndrome(pos[k], mm->msgbits);
+
+    for (a = 0; a < n && !nflips; a++) {
+        if (softFixMatches(syndrome ^ syn[a], ap)) {
+            flips[0] = a;
+            nflips = 1;
+        }
+    }
+    for (a = 0; a < n && !nflips && maxflips >= 2; a++) {
+        for (b = a+1; b < n && !nflips; b++) {
+            if (softFixMatches(syndrome ^ syn[a] ^ syn[b], ap)) {
+                flips[0] = a; flips[1] = b;
+                nflips = 2;
+            }
+        }
+    }
+    for (a = 0; a < n && !nflips && maxflips >= 3; a++) {
+        for (b = a+1; b < n && !nflips; b++) {
+            for (c = b+1; c < n && !nflips; c++) {
+                if (softFixMatches(syndrome ^ syn[a] ^ syn[b] ^ syn[c], ap)) {
+                    flips[0] = a; flips[1] = b; flips[2] = c;
+                    nflips = 3;
+                }
+            }
         }
     }
+    if (!nflips) return 0;
+
+    for (k = 0; k < nflips; k++) {
+        int j = pos[flips[k]];
+
+        mm->msg[j/8] ^= 1 << (7-(j%8));
+        syndrome ^= syn[flips[k]];
+    }
+    mm->errorbit = pos[flips[0]];
+    mm->flipped = nflips;
+    if (ap) {
+        mm->aa1 = syndrome >> 16;
+        mm->aa2 = (syndrome >> 8) & 0xff;
+        mm->aa3 = syndrome & 0xff;
+    }
+    return 1;
+}
+
+/* Return true if the message should reach the upper layers. */
+static int modesMessageIsUsable(struct modeSMessage::modesMessage *mm) {
+    return !Modes.stats && (Modes.check_crc == 0 || mm->crcok);
 }
 
-void useModesMessage(const clock_t *time, struct modeSMessage::modesMessage *mm) {
-    if (!Modes.stats && (Modes.check_crc == 0 || mm->crcok)) {
+void useModesMessage(const uint64_t *time, struct modeSMessage::modesMessage *mm) {
+    if (modesMessageIsUsable(mm)) {
+        struct modeSMessage::aircraft *a = NULL;
+
         /* Track aircrafts in interactive mode or if the HTTP
-         * interface is enabled. */
+         * interface is enabled (unless shedding load), or some client
+         * filter may need the position of the aircraft. */
         if (Modes.interactive == 1 || 
-            Modes.stat_http_requests > 0 || 
-            Modes.stat_sbs_connections > 0) 
+            (Modes.stat_http_requests > 0 &&
+             Modes.load.level < MODES_LOAD_NO_TRACKING) ||
+            Modes.stat_sbs_connections > 0 ||
+            Modes.filtered_len > 0)
           {
-            struct modeSMessage::aircraft *a = interactiveReceiveData(mm);
+            a = interactiveReceiveData(mm);
             if (a && Modes.stat_sbs_connections > 0) 
               modeSMessage::modesSendSBSOutput(mm, a);  /* Feed SBS output clients. */
           }
@@ -1103,18 +1586,69 @@ void useModesMessage(const clock_t *time, struct modeSMessage::modesMessage *mm)
         }
         /* Send data to connected clients. */
         if (Modes.net) {
-          modeSMessage::modesSendRawOutput(time, mm);  /* Feed raw output clients. */
+          modeSMessage::modesSendRawOutput(time, mm, a);  /* Feed raw output clients. */
         }
     }
 }
 
+void decodeModesBatch(struct modesBatch *batch) {
+    int j;
 
-void detectModeS(const clock_t *time, uint16_t *m, uint32_t mlen) {
-    unsigned char bits[MODES_LONG_MSG_BITS];
-    unsigned char msg[MODES_LONG_MSG_BITS/2];
-    uint16_t aux[MODES_LONG_MSG_BITS*2];
-    uint32_t j;
-    int use_correction = 0;
+    for (j = 0; j < batch->len; j++)
+        useModesMessage(&batch->times[j], &batch->msgs[j]);
+    batch->len = 0;
+
+    /* Provide data to the readers ASAP, but once per batch. */
+    modeSMessage::modesFlushOutputs();
+    if (Modes.interactive == 0) fflush(stdout);
+}
+
+/* Queue a message into the current pipeline batch, publishing the batch
+ * first if it is full. Messages that would be discarded anyway are not
+ * queued. */
+static void modesBatchAdd(const uint64_t *time,
+                          struct modeSMessage::modesMessage *mm) {
+    struct modesBatch *batch = modesPipelineBatch();
+
+    if (!modesMessageIsUsable(mm)) return;
+    if (batch->len == MODES_BATCH_LEN) {
+        modesPipelinePush();
+        batch = modesPipelineBatch();
+    }
+    batch->times[batch->len] = *time;
+    batch->msgs[batch->len++] = *mm;
+}
+
+/* Return true if no sample of the MODES_SQUELCH_SPAN windows from the
+ * window w on reaches the squelch level. */
+static int windowIsQuiet(uint32_t w, uint32_t squelch) {
+    int i;
+
+    for (i = 0; i < MODES_SQUELCH_SPAN; i++)
+        if (Modes.window_max[w+i] >= squelch) return 0;
+    return 1;
+}
+
+void detectModeS(const uint64_t *time, uint16_t *m, uint32_t mlen) {
+    struct slicer slicer[2];
+    unsigned char msg[2][MODES_LONG_MSG_BYTES];
+    uint32_t j, squelch = 0, pulse = 0;
+    int use_correction;
+    /* Under load (see modesLoad.h) or with the low-power profile,
+     * demodulate every message once, without phase correction. */
+    int lowpower = Modes.profile == MODES_PROFILE_LOW_POWER;
+    int retry = Modes.load.level < MODES_LOAD_NO_PHASE && !lowpower;
+
+    /* A message is only accepted if the average delta between the high
+     * and low samples of its bits reaches MODES_MIN_DELTA/2 (see below),
+     * so at least one of its samples does. A window where no message
+     * starting in it can have such a sample (none of the windows a
+     * message starting there spans has one) is skipped altogether. */
+    if (Modes.squelch) {
+        squelch = MODES_MIN_DELTA/2;
+        Modes.stat_squelch_windows += mlen >> MODES_SQUELCH_SHIFT;
+    }
+    if (lowpower) pulse = Modes.noise_floor * MODES_PULSE_FACTOR;
 
     /* The Mode S preamble is made of impulses of 0.5 microseconds at
      * the following time offsets:
@@ -1140,10 +1674,21 @@ void detectModeS(const clock_t *time, uint16_t *m, uint32_t mlen) {
      * 9   -------------------
      */
     for (j = 0; j < mlen - MODES_FULL_LEN*2; j++) {
-        int low, high, delta, i, errors;
-        int good_message = 0;
+        int low, high, delta, i, errors[2], signal, corrected, nbits;
+        uint16_t *p;
+        uint64_t stamp = *time + j;
+
+        if (squelch && !(j & (MODES_SQUELCH_WINDOW-1)) &&
+            windowIsQuiet(j >> MODES_SQUELCH_SHIFT, squelch)) {
+            Modes.stat_squelch_skipped++;
+            j |= MODES_SQUELCH_WINDOW-1; /* Skip to the next window. */
+            continue;
+        }
 
-        if (use_correction) goto good_preamble; /* We already checked it. */
+        /* Low-power: the first pulse of the preamble must be well over the
+         * noise floor. Most samples of a window with a message in it are
+         * rejected with a single comparison. */
+        if (m[j] < pulse) continue;
 
         /* First check of relations between the first 10 samples
          * representing a valid preamble. We don't even investigate further
@@ -1161,8 +1706,8 @@ void detectModeS(const clock_t *time, uint16_t *m, uint32_t mlen) {
         {
             if (Modes.debug & MODES_DEBUG_NOPREAMBLE &&
                 m[j] > MODES_DEBUG_NOPREAMBLE_LEVEL)
-              dumpRawMessage(time, (char*)"Unexpected ratio among first 10 samples",
-                             msg, m, j);
+              dumpRawMessage(&stamp, (char*)"Unexpected ratio among first 10 samples",
+                             msg[0], m, j);
             continue;
         }
 
@@ -1176,8 +1721,8 @@ void detectModeS(const clock_t *time, uint16_t *m, uint32_t mlen) {
         {
             if (Modes.debug & MODES_DEBUG_NOPREAMBLE &&
                 m[j] > MODES_DEBUG_NOPREAMBLE_LEVEL)
-              dumpRawMessage(time, (char*)"Too high level in samples between 3 and 6",
-                               msg, m, j);
+              dumpRawMessage(&stamp, (char*)"Too high level in samples between 3 and 6",
+                               msg[0], m, j);
             continue;
         }
 
@@ -1191,151 +1736,146 @@ void detectModeS(const clock_t *time, uint16_t *m, uint32_t mlen) {
         {
             if (Modes.debug & MODES_DEBUG_NOPREAMBLE &&
                 m[j] > MODES_DEBUG_NOPREAMBLE_LEVEL)
-              dumpRawMessage(time, (char*)"Too high level in samples between 10 and 15",
-                               msg, m, j);
+              dumpRawMessage(&stamp, (char*)"Too high level in samples between 10 and 15",
+                               msg[0], m, j);
             continue;
         }
         Modes.stat_valid_preamble++;
 
-good_preamble:
-        /* If the previous attempt with this message failed, retry using
-         * magnitude correction. */
-        if (use_correction) {
-          ::memcpy(aux,m+j+MODES_PREAMBLE_US*2,sizeof(aux));
-            if (j && detectOutOfPhase(m+j)) {
-                applyPhaseCorrection(m+j);
-                Modes.stat_out_of_phase++;
+        /* Slice the bits as they are and, if the message looks out of
+         * phase, with the phase correction applied (see
+         * phaseCorrectSample()), side by side. The magnitude vector is
+         * only read. The first byte tells the length of the message, so
+         * only the bits of the longest of the two are sliced. */
+        p = m+j+MODES_PREAMBLE_US*2;
+        corrected = j && retry && detectOutOfPhase(m+j);
+        slicer[0].msg = msg[0];
+        slicer[1].msg = msg[1];
+        errors[0] = errors[1] = sliceFirstBit(&slicer[0], p[0], p[1]);
+        slicer[1].acc = slicer[0].acc;
+        slicer[1].bit = slicer[0].bit;
+        low = p[0]; /* The first sample is never corrected. */
+        nbits = MODES_LONG_MSG_BITS;
+        for (i = 1; i < nbits; i++) {
+            sliceBit(&slicer[0], i, p[i*2], p[i*2+1]);
+            if (corrected) {
+                low = phaseCorrectSample(low > p[i*2-1], p[i*2]);
+                sliceBit(&slicer[1], i, low, p[i*2+1]);
             }
-            /* TODO ... apply other kind of corrections. */
-        }
-
-        /* Decode all the next 112 bits, regardless of the actual message
-         * size. We'll check the actual message type later. */
-        errors = 0;
-        for (i = 0; i < MODES_LONG_MSG_BITS*2; i += 2) {
-            low = m[j+i+MODES_PREAMBLE_US*2];
-            high = m[j+i+MODES_PREAMBLE_US*2+1];
-            delta = low-high;
-            if (delta < 0) delta = -delta;
-
-            if (i > 0 && delta < 256) {
-                bits[i/2] = bits[i/2-1];
-            } else if (low == high) {
-                /* Checking if two adiacent samples have the same magnitude
-                 * is an effective way to detect if it's just random noise
-                 * that was detected as a valid preamble. */
-                bits[i/2] = 2; /* error */
-                if (i < MODES_SHORT_MSG_BITS*2) errors++;
-            } else if (low > high) {
-                bits[i/2] = 1;
-            } else {
-                /* (low < high) for exclusion  */
-                bits[i/2] = 0;
+            if (i == 7) {
+                nbits = modesMessageLenByType(msg[0][0]>>3);
+                if (corrected && modesMessageLenByType(msg[1][0]>>3) > nbits)
+                    nbits = MODES_LONG_MSG_BITS;
             }
         }
-
-        /* Restore the original message if we used magnitude correction. */
-        if (use_correction)
-          ::memcpy(m+j+MODES_PREAMBLE_US*2,aux,sizeof(aux));
-
-        /* Pack bits into bytes */
-        for (i = 0; i < MODES_LONG_MSG_BITS; i += 8) {
-            msg[i/8] =
-                bits[i]<<7 | 
-                bits[i+1]<<6 | 
-                bits[i+2]<<5 | 
-                bits[i+3]<<4 | 
-                bits[i+4]<<3 | 
-                bits[i+5]<<2 | 
-                bits[i+6]<<1 | 
-                bits[i+7];
-        }
-
-        int msgtype = msg[0]>>3;
-        int msglen = modesMessageLenByType(msgtype)/8;
-
-        /* Last check, high and low bits are different enough in magnitude
-         * to mark this as real message and not just noise? */
-        delta = 0;
-        for (i = 0; i < msglen*8*2; i += 2) {
-            delta += abs(m[j+i+MODES_PREAMBLE_US*2]-
-                         m[j+i+MODES_PREAMBLE_US*2+1]);
-        }
-        delta /= msglen*4;
-
-        /* Filter for an average delta of three is small enough to let almost
-         * every kind of message to pass, but high enough to filter some
-         * random noise. */
-        if (delta < 10*255) {
-            use_correction = 0;
-            continue;
-        }
-
-        /* If we reached this point, and error is zero, we are very likely
-         * with a Mode S message in our hands, but it may still be broken
-         * and CRC may not be correct. This is handled by the next layer. */
-        if (errors == 0 || (Modes.aggressive && errors < 3)) {
-          struct modeSMessage::modesMessage mm;
-
-            /* Decode the received message and update statistics */
-            decodeModesMessage(&mm,msg);
-
-            /* Update statistics. */
-            if (mm.crcok || use_correction) {
-                if (errors == 0) Modes.stat_demodulated++;
-                if (mm.errorbit == -1) {
-                    if (mm.crcok)
-                        Modes.stat_goodcrc++;
-                    else
+        ::memset(msg[0]+nbits/8, 0, MODES_LONG_MSG_BYTES-nbits/8);
+        ::memset(msg[1]+nbits/8, 0, MODES_LONG_MSG_BYTES-nbits/8);
+
+        /* Try the bits as they are first, then the corrected ones. If the
+         * message was not out of phase the second attempt is the same as
+         * the first one, but the statistics are only updated there.
+         * Without retry only the second attempt is made. */
+        for (use_correction = !retry; use_correction < 2; use_correction++) {
+            int k = use_correction && corrected;
+            int msgtype = msg[k][0]>>3;
+            int msglen = modesMessageLenByType(msgtype)/8;
+
+            if (use_correction && corrected) Modes.stat_out_of_phase++;
+
+            /* Last check, high and low bits are different enough in
+             * magnitude to mark this as real message and not just noise?
+             * The level of the pulses is the signal strength of the
+             * message. */
+            delta = 0;
+            signal = 0;
+            for (i = 0; i < msglen*8*2; i += 2) {
+                low = p[i];
+                high = p[i+1];
+                delta += abs(low-high);
+                signal += low > high ? low : high;
+            }
+            delta /= msglen*4;
+            signal /= msglen*8;
+
+            /* Filter for an average delta of three is small enough to let
+             * almost every kind of message to pass, but high enough to
+             * filter some random noise. */
+            if (delta < MODES_MIN_DELTA) break;
+
+            /* If we reached this point, and error is zero, we are very
+             * likely with a Mode S message in our hands, but it may still
+             * be broken and CRC may not be correct. This is handled by the
+             * next layer. */
+            if (errors[k] == 0 || (Modes.aggressive && errors[k] < 3)) {
+                struct modeSMessage::modesMessage mm;
+
+                /* Decode the received message and update statistics. The
+                 * weak bits are only flipped as a last resort, after the
+                 * phase corrected bits had their chance. */
+                decodeModesMessageSoft(&mm,msg[k],use_correction ? p : NULL,k);
+                mm.signal = signal;
+
+                /* Update statistics. */
+                if (mm.crcok) {
+                    Modes.stat_signal_sum += signal;
+                    Modes.stat_signal_count++;
+                    if (signal > Modes.stat_signal_peak)
+                        Modes.stat_signal_peak = signal;
+                }
+                if (mm.crcok || use_correction) {
+                    if (errors[k] == 0) Modes.stat_demodulated++;
+                    if (mm.errorbit == -1) {
+                        if (mm.crcok)
+                            Modes.stat_goodcrc++;
+                        else
+                            Modes.stat_badcrc++;
+                    } else {
                         Modes.stat_badcrc++;
-                } else {
-                    Modes.stat_badcrc++;
-                    Modes.stat_fixed++;
-                    if (mm.errorbit < MODES_LONG_MSG_BITS)
-                        Modes.stat_single_bit_fix++;
-                    else
-                        Modes.stat_two_bits_fix++;
+                        Modes.stat_fixed++;
+                        if (mm.flipped)
+                            Modes.stat_soft_fix++;
+                        else if (mm.ap_fixed)
+                            Modes.stat_ap_fix++;
+                        else if (mm.errorbit < MODES_LONG_MSG_BITS)
+                            Modes.stat_single_bit_fix++;
+                        else
+                            Modes.stat_two_bits_fix++;
+                    }
                 }
-            }
 
-            /* Output debug mode info if needed. */
-            if (use_correction) {
-                if (Modes.debug & MODES_DEBUG_DEMOD)
-                  dumpRawMessage(time, (char*)"Demodulated with 0 errors", msg, m, j);
-                else if (Modes.debug & MODES_DEBUG_BADCRC &&
-                         mm.msgtype == 17 &&
-                         (!mm.crcok || mm.errorbit != -1))
-                  dumpRawMessage(time, (char*)"Decoded with bad CRC", msg, m, j);
-                else if (Modes.debug & MODES_DEBUG_GOODCRC && mm.crcok &&
-                         mm.errorbit == -1)
-                  dumpRawMessage(time, (char*)"Decoded with good CRC", msg, m, j);
-            }
+                /* Output debug mode info if needed. */
+                if (use_correction) {
+                    if (Modes.debug & MODES_DEBUG_DEMOD)
+                      dumpRawMessage(&stamp, (char*)"Demodulated with 0 errors", msg[k], m, j);
+                    else if (Modes.debug & MODES_DEBUG_BADCRC &&
+                             mm.msgtype == 17 &&
+                             (!mm.crcok || mm.errorbit != -1))
+                      dumpRawMessage(&stamp, (char*)"Decoded with bad CRC", msg[k], m, j);
+                    else if (Modes.debug & MODES_DEBUG_GOODCRC && mm.crcok &&
+                             mm.errorbit == -1)
+                      dumpRawMessage(&stamp, (char*)"Decoded with good CRC", msg[k], m, j);
+                }
 
-            /* Skip this message if we are sure it's fine. */
-            if (mm.crcok) {
-                j += (MODES_PREAMBLE_US+(msglen*8))*2;
-                good_message = 1;
-                if (use_correction)
-                    mm.phase_corrected = 1;
-            }
+                /* Queue it for the next layer. */
+                if (mm.crcok && use_correction) mm.phase_corrected = 1;
+                modesBatchAdd(&stamp, &mm);
 
-            /* Pass data to the next layer */
-            useModesMessage(time, &mm);
-        } else {
-            if (Modes.debug & MODES_DEBUG_DEMODERR && use_correction) {
-                ::printf("The following message has %d demod errors\n", errors);
-              dumpRawMessage(time, (char*)"Demodulated with errors", msg, m, j);
+                /* Skip this message if we are sure it's fine. */
+                if (mm.crcok) {
+                    j += (MODES_PREAMBLE_US+(msglen*8))*2;
+                    break;
+                }
+            } else {
+                if (Modes.debug & MODES_DEBUG_DEMODERR && use_correction) {
+                    ::printf("The following message has %d demod errors\n", errors[k]);
+                  dumpRawMessage(&stamp, (char*)"Demodulated with errors", msg[k], m, j);
+                }
             }
         }
-
-        /* Retry with phase correction if possible. */
-        if (!good_message && !use_correction) {
-            j--;
-            use_correction = 1;
-        } else {
-            use_correction = 0;
-        }
     }
+
+    /* Pass the whole block to the next layer. */
+    modesPipelinePush();
 }
 
 } // namespace modesDecode
@@ -4,11 +4,15 @@
 
 #include "globals.h"
 #include "modesMessage.h"
+#include "modesPipeline.h"
+#include "modesLoad.h"
+#include "modesPush.h"
+#include "modesUdp.h"
+#include "modesClock.h"
 #include "anet.h"
 #include "rtl-sdr.h"
 
 extern "C" {
-#include <sys/times.h>
 }
 
 namespace modes {
@@ -17,23 +21,39 @@ namespace modes {
 
 namespace modesDecode {
 
+/* An entry of the ICAO addresses cache. */
+struct icaoCacheEntry {
+    uint32_t addr;
+    uint32_t seen;                  /* Cached wall clock when last added. */
+};
+
+/* An address waiting to be admitted in the tracker. */
+struct probationEntry {
+    uint32_t addr;
+    int frames;                     /* Good CRC frames received. */
+    time_t seen;                    /* Last one. */
+};
+
 /* Program global state. */
 struct MMODES {
     /* Internal state */
     pthread_t reader_thread;
     pthread_mutex_t data_mutex;     /* Mutex to synchronize buffer access. */
     pthread_cond_t data_cond;       /* Conditional variable associated. */
-    clock_t time;                   /* time stamp when the IQ samples get 
-                                       copied into the data buffer */
-    struct tms cpu_time;            /* time stamp when the IQ samples get 
-                                       copied into the data buffer */
+    struct modeSMessage::modesClock clock; /* Cached clocks. */
     unsigned char *data;            /* Raw IQ samples buffer */
     uint16_t *magnitude;            /* Magnitude vector */
+    int noise_level;                /* Noise floor of the last block. */
+    int noise_floor;                /* Running noise floor estimate. */
+    uint16_t *window_max;           /* Max magnitude of every squelch window. */
     uint32_t data_len;              /* Buffer length. */
     int fd;                         /* --ifile or --rfile option file descriptor. */
     int data_ready;                 /* Data ready to be processed. */
-    uint32_t *icao_cache;           /* Recently seen ICAO addresses cache. */
+    struct icaoCacheEntry *icao_cache; /* Recently seen ICAO addresses cache. */
+    int icao_cache_len;             /* Entries, a power of two. */
+    pthread_mutex_t icao_mutex;     /* Shared by demodulator and decoder. */
     uint16_t *maglut;               /* I/Q -> Magnitude lookup table. */
+    uint8_t *maglut8;               /* Same, 8 bits, low-power profile only. */
     int exit;                       /* Exit from the main loop when true. */
 
     /* RTLSDR */
@@ -45,12 +65,27 @@ struct MMODES {
 
     /* Networking */
     char aneterr[ANET_ERR_LEN];
-  struct modes::client *clients[MODES_NET_MAX_FD]; /* Our clients. */
+    struct modes::client **clients; /* Our clients, indexed by fd. */
+    int clients_len;                /* Size of the clients table. */
     int maxfd;                      /* Greatest fd currently active. */
+    pthread_mutex_t clients_mutex;  /* Shared by network and decoder. */
+    int raw_clients;                /* Output clients without a filter. */
+    int sbs_clients;
+    struct modes::client **filtered; /* Output clients with a filter. */
+    int filtered_len;
+    int filtered_size;
+    pthread_t net_thread;
     int sbsos;                      /* SBS output listening socket. */
     int ros;                        /* Raw output listening socket. */
     int ris;                        /* Raw input listening socket. */
     int https;                      /* HTTP listening socket. */
+    char rawout[MODES_NET_OUT_BUF_SIZE]; /* Pending raw output. */
+    int rawoutlen;
+    char sbsout[MODES_NET_OUT_BUF_SIZE]; /* Pending SBS output. */
+    int sbsoutlen;
+    struct modeSMessage::modesPushTarget **push; /* --net-push targets. */
+    int push_count;
+    struct modeSMessage::modesUdpOutput udp; /* --net-udp output. */
 
     /* Configuration */
     char *ifilename;                /* Input form file, --ifile option. */
@@ -72,9 +107,23 @@ struct MMODES {
     int onlyaddr;                   /* Print only ICAO addresses. */
     int metric;                     /* Use metric units. */
     int aggressive;                 /* Aggressive detection algorithm. */
+    int squelch;                    /* Skip the quiet windows. */
+    int profile;                    /* MODES_PROFILE_* */
+
+    /* Demodulated messages on their way to the decoder thread. */
+    struct modesPipeline pipeline;
+    struct modesLoad load;          /* Load shedding, live input. */
 
     /* Interactive mode */
   struct modeSMessage::aircraft *aircrafts;
+    pthread_mutex_t aircrafts_mutex; /* The HTTP server reads the list. */
+    struct modeSMessage::aircraftPool aircraft_pool;
+    struct modeSMessage::aircraft *expiry[MODES_EXPIRY_WHEEL_SIZE]; /* Timer wheel. */
+    time_t expiry_time;             /* Next second of the wheel to process. */
+    struct modeSMessage::aircraft *lru_head; /* Most recently seen... */
+    struct modeSMessage::aircraft *lru_tail; /* ...and evicted first. */
+    struct probationEntry probation[MODES_PROBATION_LEN];
+    int max_aircrafts;              /* Tracker cap. */
     long interactive_last_update;  /* Last screen update in milliseconds */
 
     /* Statistics */
@@ -88,6 +137,20 @@ struct MMODES {
     long stat_http_requests;
     long stat_sbs_connections;
     long stat_out_of_phase;
+    long stat_admitted;             /* Addresses admitted in the tracker. */
+    long stat_probation;            /* Messages of addresses on probation. */
+    long stat_rejected;             /* Bad CRC messages of unknown addresses. */
+    long stat_evicted;              /* Aircrafts dropped by a full tracker. */
+    long stat_icao_hits;            /* ICAO cache lookups... */
+    long stat_icao_misses;
+    long stat_icao_evictions;       /* Fresh entries replaced. */
+    long stat_signal_sum;           /* Magnitude of the good messages... */
+    long stat_signal_count;
+    int stat_signal_peak;
+    long stat_squelch_windows;      /* Squelch windows demodulated... */
+    long stat_squelch_skipped;      /* ...and skipped as quiet. */
+    long stat_soft_fix;             /* Errors fixed flipping weak bits. */
+    long stat_ap_fix;               /* AP errors fixed with the ICAO cache. */
 };
 
  extern struct MMODES Modes;
@@ -98,15 +161,48 @@ struct MMODES {
 
  /* Detect a Mode S messages inside the magnitude buffer pointed by 'm' and of
   * size 'mlen' bytes. Every detected Mode S message is convert it into a
-  * stream of bits and passed to the function to display it. */
- void detectModeS(const clock_t* time, uint16_t *m, uint32_t mlen);
+  * stream of bits, queued into the current pipeline batch, and the batch
+  * is published to the decoder thread at the end of the buffer. */
+ void detectModeS(const uint64_t* time, uint16_t *m, uint32_t mlen);
 
- /* Decode a raw Mode S message demodulated as a stream of bytes by
-  * detectModeS(), and split it into fields populating a modesMessage
-  * structure. */
+ /* Decode the header of a raw Mode S message demodulated as a stream of
+  * bytes by detectModeS(): DF, length, CRC (fixing errors if possible) and
+  * ICAO address. This is all the raw output and relaying need. */
  void decodeModesMessage(struct modeSMessage::modesMessage *mm, 
                          unsigned char *msg);
 
+ /* Same as decodeModesMessage(), called by the demodulator on its last
+  * attempt at a message. When the checksum is wrong, single bit errors of
+  * the AP formats are fixed with the ICAO cache, and the message samples
+  * 'p' (after the preamble, phase corrected if 'corrected') are used to
+  * find the least reliable bits and try flipping them. */
+ void decodeModesMessageSoft(struct modeSMessage::modesMessage *mm,
+                             unsigned char *msg, uint16_t *p, int corrected);
+
+ /* Split a message decoded by decodeModesMessage() into the fields of its
+  * DF / ME type. Consumers call it on demand, only the first call does
+  * the work. */
+ void decodeModesFields(struct modeSMessage::modesMessage *mm);
+
+ /* Returns 1 if the address was seen in a DF11 or DF17 message with a good
+  * checksum in the last MODES_ICAO_CACHE_TTL seconds. */
+ int ICAOAddressWasRecentlySeen(uint32_t addr);
+
+ /* Print the ICAO cache statistics. */
+ void ICAOCacheShowStats(void);
+
+ /* Convert a magnitude (as in the magnitude vector) to dBFS. */
+ double signalToDbfs(int level);
+
+ /* Print the signal level and noise floor statistics. */
+ void signalShowStats(void);
+
+ /* Print the squelch statistics. */
+ void squelchShowStats(void);
+
+ /* Print the decoding profile, decode rate and CPU time. */
+ void profileShowStats(void);
+
  /* When a new message is available, because it was decoded from the
   * RTL device, file, or received in the TCP input port, or any other
   * way we can receive a decoded message, we call this function in order
@@ -114,7 +210,12 @@ struct MMODES {
   *
   * Basically this function passes a raw message to the upper layers for
   * further processing and visualization. */ 
- void useModesMessage(const clock_t* time, struct modeSMessage::modesMessage *mm);
+ void useModesMessage(const uint64_t* time, struct modeSMessage::modesMessage *mm);
+
+ /* Decode and dispatch all the messages collected in 'batch' by
+  * detectModeS(), in order, then flush the outputs once for the whole
+  * batch. The batch is empty on return. */
+ void decodeModesBatch(struct modesBatch *batch);
 
  /* Turn I/Q samples pointed by Modes.data into the magnitude vector
   * pointed by Modes.magnitude. */
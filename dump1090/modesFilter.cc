@@ -0,0 +1,187 @@
+
+#include "modesFilter.h"
+#include "modesDecode.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace modeSMessage {
+
+static const uint32_t ICAO_EMPTY = 0xffffffff;
+
+/* Hash set of ICAO addresses, open addressing with linear probing. */
+static uint32_t icaoHash(uint32_t a) {
+    a = ((a >> 16) ^ a) * 0x45d9f3b;
+    return (a >> 16) ^ a;
+}
+
+static void icaoSetAdd(struct clientFilter *f, uint32_t addr) {
+    uint32_t j = icaoHash(addr) & (f->icao_size-1);
+
+    while (f->icao[j] != ICAO_EMPTY && f->icao[j] != addr)
+        j = (j+1) & (f->icao_size-1);
+    f->icao[j] = addr;
+}
+
+static int icaoSetHas(struct clientFilter *f, uint32_t addr) {
+    uint32_t j = icaoHash(addr) & (f->icao_size-1);
+
+    while (f->icao[j] != ICAO_EMPTY) {
+        if (f->icao[j] == addr) return 1;
+        j = (j+1) & (f->icao_size-1);
+    }
+    return 0;
+}
+
+/* Parse the comma separated list of ICAO addresses and prefixes. */
+static int parseIcao(struct clientFilter *f, char *list) {
+    int count = 1, j;
+    char *p, *tok, *save;
+
+    for (p = list; *p; p++) if (*p == ',') count++;
+    for (f->icao_size = 4; f->icao_size < count*2; f->icao_size *= 2);
+    f->icao = (uint32_t*)::malloc(sizeof(uint32_t)*f->icao_size);
+    if (f->icao == NULL) return -1;
+    for (j = 0; j < f->icao_size; j++) f->icao[j] = ICAO_EMPTY;
+
+    for (tok = ::strtok_r(list, ",", &save); tok;
+         tok = ::strtok_r(NULL, ",", &save)) {
+        int len = ::strlen(tok), prefix = 0;
+        uint32_t addr;
+
+        if (len > 1 && tok[len-1] == '*') {
+            tok[--len] = '\0';
+            prefix = 1;
+        }
+        if (len == 0 || len > 6 || (!prefix && len != 6) ||
+            ::strspn(tok, "0123456789abcdefABCDEF") != (size_t)len)
+            return -1;
+        addr = ::strtoul(tok, NULL, 16);
+        if (prefix) {
+            if (f->prefixes == modesDecode::MODES_FILTER_MAX_PREFIXES) return -1;
+            f->prefix_mask[f->prefixes] = (0xffffff << (24-len*4)) & 0xffffff;
+            f->prefix[f->prefixes++] = addr << (24-len*4);
+        } else {
+            icaoSetAdd(f, addr);
+        }
+    }
+    f->has_icao = 1;
+    return 0;
+}
+
+struct clientFilter *modesCompileFilter(const char *line, int *err) {
+    struct clientFilter *f;
+    char *copy, *tok, *save;
+    int terms = 0;
+
+    *err = 0;
+    f = (struct clientFilter*)::calloc(1, sizeof(*f));
+    copy = ::strdup(line);
+    if (f == NULL || copy == NULL) goto fail;
+
+    for (tok = ::strtok_r(copy, " \t\r", &save); tok;
+         tok = ::strtok_r(NULL, " \t\r", &save)) {
+        char *val = ::strchr(tok, '='), *end;
+
+        if (val == NULL) goto fail;
+        *val++ = '\0';
+        if (!::strcmp(tok, "df")) {
+            char *df, *dfsave;
+
+            for (df = ::strtok_r(val, ",", &dfsave); df;
+                 df = ::strtok_r(NULL, ",", &dfsave)) {
+                long n = ::strtol(df, &end, 10);
+
+                if (*end || n < 0 || n > 31) goto fail;
+                f->dfmask |= 1U << n;
+            }
+        } else if (!::strcmp(tok, "icao")) {
+            if (f->has_icao || parseIcao(f, val) == -1) goto fail;
+        } else if (!::strcmp(tok, "alt")) {
+            char *colon = ::strchr(val, ':');
+
+            if (colon == NULL) goto fail;
+            *colon = '\0';
+            f->alt_min = *val ? ::strtol(val, &end, 10) : -100000;
+            if (*val && *end) goto fail;
+            f->alt_max = colon[1] ? ::strtol(colon+1, &end, 10) : 1000000;
+            if (colon[1] && *end) goto fail;
+            f->has_alt = 1;
+        } else if (!::strcmp(tok, "bbox")) {
+            double lat1, lon1, lat2, lon2;
+
+            if (::sscanf(val, "%lf,%lf,%lf,%lf", &lat1, &lon1, &lat2, &lon2)
+                != 4) goto fail;
+            f->lat_min = lat1 < lat2 ? lat1 : lat2;
+            f->lat_max = lat1 < lat2 ? lat2 : lat1;
+            f->lon_min = lon1 < lon2 ? lon1 : lon2;
+            f->lon_max = lon1 < lon2 ? lon2 : lon1;
+            f->has_bbox = 1;
+        } else {
+            goto fail;
+        }
+        terms++;
+    }
+    ::free(copy);
+    if (terms) return f;
+    modesFreeFilter(f);
+    return NULL;
+
+fail:
+    ::free(copy);
+    modesFreeFilter(f);
+    *err = 1;
+    return NULL;
+}
+
+void modesFreeFilter(struct clientFilter *f) {
+    if (f == NULL) return;
+    ::free(f->icao);
+    ::free(f);
+}
+
+int modesFilterMatch(struct clientFilter *f, struct modesMessage *mm,
+                     struct aircraft *a) {
+    /* Cheapest tests first. */
+    if (f->dfmask && !(f->dfmask & (1U << mm->msgtype))) return 0;
+
+    if (f->has_icao) {
+        uint32_t addr = (mm->aa1 << 16) | (mm->aa2 << 8) | mm->aa3;
+        int j, found = icaoSetHas(f, addr);
+
+        for (j = 0; !found && j < f->prefixes; j++)
+            found = (addr & f->prefix_mask[j]) == f->prefix[j];
+        if (!found) return 0;
+    }
+
+    if (f->has_alt) {
+        int altitude;
+
+        /* Use the altitude of the message if it has one (in feet, like
+         * the filter), otherwise the last one known for the aircraft. */
+        modesDecode::decodeModesFields(mm);
+        if (mm->msgtype == 0 || mm->msgtype == 4 || mm->msgtype == 16 ||
+            mm->msgtype == 20 ||
+            (mm->msgtype == 17 && mm->metype >= 9 && mm->metype <= 18))
+        {
+            altitude = mm->altitude;
+            if (mm->unit == modesDecode::MODES_UNIT_METERS)
+                altitude *= 3.2828;
+        } else if (a && a->altitude)
+            altitude = a->altitude;
+        else
+            return 0;
+        if (altitude < f->alt_min || altitude > f->alt_max) return 0;
+    }
+
+    if (f->has_bbox) {
+        /* Single frames don't carry a position, use the last known one. */
+        if (a == NULL || (a->lat == 0 && a->lon == 0)) return 0;
+        if (a->lat < f->lat_min || a->lat > f->lat_max ||
+            a->lon < f->lon_min || a->lon > f->lon_max) return 0;
+    }
+    return 1;
+}
+
+} // namespace
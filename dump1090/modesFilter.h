@@ -0,0 +1,45 @@
+#ifndef MODESFILTER_H
+#define MODESFILTER_H
+
+#include "modesMessage.h"
+
+extern "C" {
+#include <stdint.h>
+}
+
+namespace modeSMessage {
+
+/* Subscription filter of a raw or SBS output client, compiled from the
+ * line the client sent, like:
+ *
+ *   df=17,11 icao=4B1234,3C* alt=0:10000 bbox=45.0,7.0,46.0,9.0
+ *
+ * All the terms must match. See the README for the details. */
+struct clientFilter {
+    uint32_t dfmask;                /* Accepted DF types, 0 = any. */
+    uint32_t *icao;                 /* ICAO addresses hash set. */
+    int icao_size;                  /* Slots in the set, a power of two. */
+    uint32_t prefix[modesDecode::MODES_FILTER_MAX_PREFIXES]; /* ICAO address prefixes, */
+    uint32_t prefix_mask[modesDecode::MODES_FILTER_MAX_PREFIXES]; /* and their masks. */
+    int prefixes;
+    int has_icao;                   /* The set or the prefixes are used. */
+    int has_alt;
+    int alt_min, alt_max;           /* Feet. */
+    int has_bbox;
+    double lat_min, lat_max, lon_min, lon_max;
+};
+
+ /* Compile a filter line. Returns NULL if it has no terms (meaning no
+  * filter), and sets *err to 1 if the line is invalid. */
+ struct clientFilter *modesCompileFilter(const char *line, int *err);
+
+ void modesFreeFilter(struct clientFilter *f);
+
+ /* Return 1 if the message (and the aircraft that sent it, if known)
+  * passes the filter. */
+ int modesFilterMatch(struct clientFilter *f, struct modesMessage *mm,
+                      struct aircraft *a);
+
+} // namespace
+
+#endif
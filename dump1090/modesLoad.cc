@@ -0,0 +1,100 @@
+
+#include "modesLoad.h"
+#include "modesDecode.h"
+#include "modesMessage.h"
+
+#include <cstdio>
+
+namespace modesDecode {
+
+static const char *levelNames[] = {
+    "full decoding",
+    "weak bits and AP fixes disabled",
+    "two bits fixes disabled",
+    "phase correction disabled",
+    "HTTP tracking disabled"
+};
+
+void modesInitLoad(void) {
+    struct modesLoad *l = &Modes.load;
+    int j;
+
+    /* Reading from file we are never late. */
+    l->enabled = !Modes.pipeline.blocking;
+    l->level = MODES_LOAD_FULL;
+    l->load = 0;
+    l->hold = MODES_LOAD_HOLD_DOWN;
+    l->decode_us = 0;
+    l->stat_blocks = 0;
+    l->stat_overloaded = 0;
+    l->stat_down = 0;
+    l->stat_up = 0;
+    for (j = 0; j < MODES_LOAD_LEVELS; j++) l->stat_level_blocks[j] = 0;
+}
+
+const char *modesLoadLevelName(int level) {
+    return levelNames[level];
+}
+
+static void modesLoadSetLevel(struct modesLoad *l, int level) {
+    if (level > l->level) l->stat_down++; else l->stat_up++;
+    l->level = level;
+    __sync_synchronize();
+    ::fprintf(stderr, "Load %d%%, decoding level %d: %s.\n",
+              l->load, level, modesLoadLevelName(level));
+}
+
+void modesLoadUpdate(long busy_us, uint32_t samples) {
+    struct modesLoad *l = &Modes.load;
+    struct modesPipeline *p = &Modes.pipeline;
+    long block_us = samples/2;      /* 2 MHz sample rate. */
+    long decode_us = p->stat_decode_us;
+    long busy;
+    unsigned int queued = p->head - p->tail;
+
+    /* The decoder thread works in parallel: the slowest of the two
+     * stages is the one that falls behind. */
+    if (decode_us - l->decode_us > busy_us) busy_us = decode_us - l->decode_us;
+    l->decode_us = decode_us;
+    busy = block_us ? busy_us*100/block_us : 0;
+    l->load = (l->load*3 + (int)busy)/4;
+
+    l->stat_blocks++;
+    l->stat_level_blocks[l->level]++;
+    if (busy > MODES_LOAD_HIGH) l->stat_overloaded++;
+    if (!l->enabled) return;
+
+    if (l->hold > 0) {
+        l->hold--;
+        return;
+    }
+    if ((l->load > MODES_LOAD_HIGH ||
+         queued >= (unsigned int)MODES_PIPELINE_DEPTH/2) &&
+        l->level < MODES_LOAD_LEVELS-1)
+    {
+        modesLoadSetLevel(l, l->level+1);
+        l->hold = MODES_LOAD_HOLD_DOWN;
+    } else if (l->load < MODES_LOAD_LOW && queued <= 1 &&
+               l->level > MODES_LOAD_FULL)
+    {
+        modesLoadSetLevel(l, l->level-1);
+        l->hold = MODES_LOAD_HOLD_UP;
+    }
+}
+
+void modesLoadShowStats(void) {
+    struct modesLoad *l = &Modes.load;
+    int j;
+
+    ::printf("load %d%%, decoding level %d (%s), %ld of %ld blocks "
+             "overloaded, %ld steps down, %ld up\n", l->load, l->level,
+             modesLoadLevelName(l->level), l->stat_overloaded,
+             l->stat_blocks, l->stat_down, l->stat_up);
+    for (j = 1; j < MODES_LOAD_LEVELS; j++) {
+        if (l->stat_level_blocks[j])
+            ::printf("%ld blocks with %s\n", l->stat_level_blocks[j],
+                     modesLoadLevelName(j));
+    }
+}
+
+} // namespace modesDecode
@@ -0,0 +1,68 @@
+#ifndef MODESLOAD_H
+#define MODESLOAD_H
+
+#include "globals.h"
+
+extern "C" {
+#include <stdint.h>
+}
+
+namespace modesDecode {
+
+/* Load shedding.
+ *
+ * With live input the reader never waits: if the demodulator or the
+ * decoder can't keep up, blocks of samples or batches of messages are
+ * lost. To avoid that, the main thread measures after every block how
+ * long the demodulator and the decoder thread worked, as a percentage of
+ * the time the block lasts (its samples at 2 MHz), smoothed over a few
+ * blocks. Over MODES_LOAD_HIGH, or when the pipeline ring is half full,
+ * the optional work is shed one level at a time:
+ *
+ *  MODES_LOAD_NO_SOFT_FIX   the weak bits flips and the AP single bit
+ *                           fixes are disabled (up to 92 CRCs, or about
+ *                           107 ICAO cache lookups, per bad message),
+ *  MODES_LOAD_NO_TWO_BITS   two bits fixes (--aggressive) are disabled,
+ *  MODES_LOAD_NO_PHASE      messages are no longer demodulated again
+ *                           after phase correction,
+ *  MODES_LOAD_NO_TRACKING   aircrafts are no longer tracked just for the
+ *                           HTTP clients (interactive mode, SBS output and
+ *                           the client filters still need it).
+ *
+ * Under MODES_LOAD_LOW the work is restored one level at a time. A level
+ * is kept at least MODES_LOAD_HOLD_DOWN blocks before shedding more, and
+ * MODES_LOAD_HOLD_UP blocks before restoring, so that the level doesn't
+ * flap. Reading from file the reader waits for us, so the level never
+ * changes. */
+struct modesLoad {
+    int enabled;                    /* Live input only. */
+    volatile int level;             /* MODES_LOAD_* level, read by all threads. */
+    int load;                       /* Smoothed busy percentage. */
+    int hold;                       /* Blocks before the next transition. */
+    long decode_us;                 /* Decoder busy time at the last block. */
+
+    /* Statistics */
+    long stat_blocks;
+    long stat_overloaded;           /* Blocks over MODES_LOAD_HIGH. */
+    long stat_down;                 /* Transitions shedding work... */
+    long stat_up;                   /* ...and restoring it. */
+    long stat_level_blocks[MODES_LOAD_LEVELS]; /* Blocks at every level. */
+};
+
+ void modesInitLoad(void);
+
+ /* Account a block of 'samples' samples that took 'busy_us' microseconds
+  * to demodulate, and change the level if needed. Called by the main
+  * thread after every block. */
+ void modesLoadUpdate(long busy_us, uint32_t samples);
+
+ /* Short description of a MODES_LOAD_* level. */
+ const char *modesLoadLevelName(int level);
+
+ /* Print the load shedding statistics. */
+ void modesLoadShowStats(void);
+
+} // namespace
+
+
+#endif
@@ -2,28 +2,33 @@
 #include "modesMessage.h"
 #include "modesDecode.h"
 #include "Client.h"
+#include "modesPush.h"
+#include "modesUdp.h"
+#include "modesFilter.h"
 
 #include <cstring>
 #include <cstdio>
 #include <cmath>
 
+#include <cerrno>
+
 extern "C" {
 #include <unistd.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 }
 
 
 namespace modeSMessage {
 
-long mstime(void) {
+long ustime(void) {
     struct timeval tv;
-    long mst;
 
     ::gettimeofday(&tv, NULL);
-    mst = ((long)tv.tv_sec)*1000;
-    mst += tv.tv_usec/1000;
-    return mst;
+    return ((long)tv.tv_sec)*1000000 + tv.tv_usec;
 }
 
 /* ============================= Utility functions ========================== */
@@ -166,10 +171,182 @@ struct aircraft *interactiveFindAircraft(uint32_t addr) {
 }
 
 
+/* Take an aircraft structure from the pool, allocating a new slab if the
+ * free list is empty. */
+static struct aircraft *aircraftPoolAlloc(void) {
+    struct aircraftPool *pool = &modesDecode::Modes.aircraft_pool;
+    struct aircraft *a;
+
+    if (pool->free == NULL) {
+        struct aircraftSlab *slab;
+        int j;
+
+        slab = (struct aircraftSlab*)::malloc(sizeof(*slab));
+        if (slab == NULL) {
+            ::fprintf(stderr, "Out of memory allocating aircrafts.\n");
+            ::exit(1);
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->slabs_count++;
+        /* Chain the new aircrafts in memory order. */
+        for (j = 0; j < modesDecode::MODES_AIRCRAFT_SLAB-1; j++)
+            slab->items[j].next = &slab->items[j+1];
+        slab->items[j].next = NULL;
+        pool->free = slab->items;
+    }
+    a = pool->free;
+    pool->free = a->next;
+    pool->allocs++;
+    if (++pool->in_use > pool->peak) pool->peak = pool->in_use;
+    return a;
+}
+
+/* Give an aircraft back to the pool. */
+static void aircraftPoolFree(struct aircraft *a) {
+    struct aircraftPool *pool = &modesDecode::Modes.aircraft_pool;
+
+    a->next = pool->free;
+    pool->free = a;
+    pool->in_use--;
+    pool->frees++;
+}
+
+/* Add an aircraft on the head of the list. */
+static void aircraftLinkHead(struct aircraft *a) {
+    a->prev = NULL;
+    a->next = modesDecode::Modes.aircrafts;
+    if (a->next) a->next->prev = a;
+    modesDecode::Modes.aircrafts = a;
+}
+
+/* Remove an aircraft from the list. */
+static void aircraftUnlink(struct aircraft *a) {
+    if (a->prev)
+        a->prev->next = a->next;
+    else
+        modesDecode::Modes.aircrafts = a->next;
+    if (a->next) a->next->prev = a->prev;
+}
+
+/* Add an aircraft on the head of the least recently seen list. */
+static void aircraftLruLinkHead(struct aircraft *a) {
+    a->lru_prev = NULL;
+    a->lru_next = modesDecode::Modes.lru_head;
+    if (a->lru_next)
+        a->lru_next->lru_prev = a;
+    else
+        modesDecode::Modes.lru_tail = a;
+    modesDecode::Modes.lru_head = a;
+}
+
+/* Remove an aircraft from the least recently seen list. */
+static void aircraftLruUnlink(struct aircraft *a) {
+    if (a->lru_prev)
+        a->lru_prev->lru_next = a->lru_next;
+    else
+        modesDecode::Modes.lru_head = a->lru_next;
+    if (a->lru_next)
+        a->lru_next->lru_prev = a->lru_prev;
+    else
+        modesDecode::Modes.lru_tail = a->lru_prev;
+}
+
+/* File the aircraft in the expiry timer wheel, under the second it will
+ * expire at if no other message is received. */
+static void aircraftScheduleExpiry(struct aircraft *a) {
+    int slot = (a->seen + modesDecode::Modes.interactive_ttl + 1) %
+               modesDecode::MODES_EXPIRY_WHEEL_SIZE;
+
+    a->expiry_slot = slot;
+    a->expiry_next = modesDecode::Modes.expiry[slot];
+    modesDecode::Modes.expiry[slot] = a;
+}
+
+/* Remove the aircraft from the expiry timer wheel. */
+static void aircraftCancelExpiry(struct aircraft *a) {
+    struct aircraft **p = &modesDecode::Modes.expiry[a->expiry_slot];
+
+    while (*p != a) p = &(*p)->expiry_next;
+    *p = a->expiry_next;
+}
+
+/* Decide if a new address deserves an aircraft structure. Addresses that
+ * are in the ICAO cache (seen in a DF11 or DF17 message with a good,
+ * uncorrected CRC) are admitted at once. Other addresses are put on
+ * probation, and admitted after MODES_PROBATION_FRAMES messages with a
+ * good CRC in a short time. Messages with a bad CRC (--no-crc-check) never
+ * admit an address, so noise can't fill the tracker.
+ *
+ * Probation uses a small direct mapped table: colliding addresses just
+ * replace each other, keeping the memory and the cost bounded. */
+static int interactiveAdmitAircraft(uint32_t addr,
+                                    struct modeSMessage::modesMessage *mm,
+                                    time_t now) {
+    struct modesDecode::probationEntry *e;
+    uint32_t h;
+
+    if (modesDecode::ICAOAddressWasRecentlySeen(addr)) {
+        modesDecode::Modes.stat_admitted++;
+        return 1;
+    }
+    if (!mm->crcok) {
+        modesDecode::Modes.stat_rejected++;
+        return 0;
+    }
+
+    h = ((addr >> 16) ^ addr) * 0x45d9f3b;
+    h = ((h >> 16) ^ h) & (modesDecode::MODES_PROBATION_LEN-1);
+    e = &modesDecode::Modes.probation[h];
+    if (e->addr != addr ||
+        now - e->seen > modesDecode::MODES_PROBATION_TTL) {
+        e->addr = addr;
+        e->frames = 0;
+    }
+    e->seen = now;
+    if (++e->frames < modesDecode::MODES_PROBATION_FRAMES) {
+        modesDecode::Modes.stat_probation++;
+        return 0;
+    }
+    e->addr = 0;
+    modesDecode::Modes.stat_admitted++;
+    return 1;
+}
+
+/* The tracker is full: drop the least recently seen aircraft, the tail
+ * of the LRU list (every message moves its aircraft on the head), so the
+ * cost doesn't depend on the number of aircrafts and stale aircrafts go
+ * first, however many messages they sent. */
+static void interactiveEvictAircraft(void) {
+    struct aircraft *victim = modesDecode::Modes.lru_tail;
+
+    if (victim == NULL) return;
+    aircraftCancelExpiry(victim);
+    aircraftLruUnlink(victim);
+    aircraftUnlink(victim);
+    aircraftPoolFree(victim);
+    modesDecode::Modes.stat_evicted++;
+}
+
+void trackerShowStats(void) {
+    struct aircraftPool *pool = &modesDecode::Modes.aircraft_pool;
+
+    ::printf("%ld aircraft slabs (%ld bytes), %ld aircrafts in use, "
+             "peak %ld\n", pool->slabs_count,
+             pool->slabs_count*(long)sizeof(struct aircraftSlab),
+             pool->in_use, pool->peak);
+    ::printf("%ld aircraft allocations, %ld returned to the pool\n",
+             pool->allocs, pool->frees);
+    ::printf("%ld addresses admitted, %ld messages on probation, "
+             "%ld rejected, %ld aircrafts evicted\n",
+             modesDecode::Modes.stat_admitted, modesDecode::Modes.stat_probation,
+             modesDecode::Modes.stat_rejected, modesDecode::Modes.stat_evicted);
+}
+
 /* Return a new aircraft structure for the interactive mode linked list
  * of aircrafts. */
 struct modeSMessage::aircraft *interactiveCreateAircraft(uint32_t addr) {
-  struct modeSMessage::aircraft *a = (struct aircraft*)::malloc(sizeof(*a));
+  struct modeSMessage::aircraft *a = aircraftPoolAlloc();
 
     a->addr = addr;
     ::snprintf(a->hexaddr,sizeof(a->hexaddr),"%06x",(int)addr);
@@ -188,90 +365,232 @@ struct modeSMessage::aircraft *interactiveCreateAircraft(uint32_t addr) {
     a->even_cprtime = 0;
     a->lat = 0;
     a->lon = 0;
-    a->seen = ::time(NULL);
+    a->seen = modesClockSec();
     a->messages = 0;
+    a->signal = 0;
+    a->signal_peak = 0;
     a->next = NULL;
+    a->prev = NULL;
+    a->expiry_next = NULL;
+    a->expiry_slot = 0;
+    a->lru_next = NULL;
+    a->lru_prev = NULL;
     return a;
 }
 
 
-/* On error free the client, collect the structure, adjust maxfd if needed. */
-void modesFreeClient(int fd) {
-  ::close(fd);
-  ::free(modesDecode::Modes.clients[fd]);
-    modesDecode::Modes.clients[fd] = NULL;
-
-    if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
-        ::printf("Closing client %d\n", fd);
+/* Return the counter of the unfiltered clients of an output service. */
+static int *unfilteredClients(int service) {
+    if (service == modesDecode::Modes.ros)
+        return &modesDecode::Modes.raw_clients;
+    if (service == modesDecode::Modes.sbsos)
+        return &modesDecode::Modes.sbs_clients;
+    return NULL;
+}
 
-    /* If this was our maxfd, rescan the full clients array to check what's
-     * the new max. */
-    if (modesDecode::Modes.maxfd == fd) {
-        int j;
+/* Remove a client from the list of the clients with a filter. The caller
+ * must hold Modes.clients_mutex. */
+static void removeFiltered(struct modes::client *c) {
+    int j;
 
-        modesDecode::Modes.maxfd = -1;
-        for (j = 0; j < modesDecode::MODES_NET_MAX_FD; j++) {
-            if (modesDecode::Modes.clients[j]) modesDecode::Modes.maxfd = j;
+    for (j = 0; j < modesDecode::Modes.filtered_len; j++) {
+        if (modesDecode::Modes.filtered[j] == c) {
+            modesDecode::Modes.filtered[j] =
+              modesDecode::Modes.filtered[--modesDecode::Modes.filtered_len];
+            break;
         }
     }
 }
 
+/* On error free the client, collect the structure, adjust maxfd if needed.
+ * Only the network thread frees clients, the decoder thread just shuts
+ * down the connection with closeClient() when a write fails. */
+void modesFreeClient(int fd) {
+    struct modes::client *c = modesDecode::Modes.clients[fd];
+    int *unfiltered = unfilteredClients(c->service);
+
+    ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+    if (c->filter)
+        removeFiltered(c);
+    else if (unfiltered)
+        (*unfiltered)--;
+    modesDecode::Modes.clients[fd] = NULL;
+
+    /* If this was our maxfd, look for the new max going down the clients
+     * table. */
+    while (modesDecode::Modes.maxfd >= 0 &&
+           modesDecode::Modes.clients[modesDecode::Modes.maxfd] == NULL)
+        modesDecode::Modes.maxfd--;
+    ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
 
+    ::close(fd);
+    modesFreeFilter(c->filter);
+    ::free(c->out);
+    ::free(c->in);
+    ::free(c);
 
-/* Send the specified message to all clients listening for a given service. */
+    if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
+        ::printf("Closing client %d\n", fd);
+}
+
+/* Stop writing to a client that can't keep up, and let the network
+ * thread free it when it reads the end of file. */
+static void closeClient(struct modes::client *c) {
+    c->closing = 1;
+    ::shutdown(c->fd, SHUT_RDWR);
+}
+
+/* Send the specified message to all the clients without a filter listening
+ * for a given service. Clients are accepted and read by the network
+ * thread, so the client table is locked while we walk it. */
 void modesSendAllClients(int service, void *msg, int len) {
     int j;
     struct modes::client *c;
 
+    ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
     for (j = 0; j <= modesDecode::Modes.maxfd; j++) {
         c = modesDecode::Modes.clients[j];
-        if (c && c->service == service) {
+        if (c && c->service == service && !c->filter && !c->closing) {
             int nwritten = write(j, msg, len);
             if (nwritten != len) {
-                modesFreeClient(j);
+                closeClient(c);
             }
         }
     }
+    ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+}
+
+/* Send the pending output of a client with a filter. The caller must hold
+ * Modes.clients_mutex. */
+static void flushFiltered(struct modes::client *c) {
+    if (c->outlen && !c->closing && ::write(c->fd, c->out, c->outlen) != c->outlen)
+        closeClient(c);
+    c->outlen = 0;
+}
+
+/* Send the pending raw and SBS output to the clients. Called once per
+ * batch of messages, so clients get a single write() per batch instead
+ * of one per message. */
+void modesFlushOutputs(void) {
+    int j;
+
+    if (modesDecode::Modes.rawoutlen) {
+        if (modesDecode::Modes.raw_clients)
+            modesSendAllClients(modesDecode::Modes.ros, modesDecode::Modes.rawout,
+                                modesDecode::Modes.rawoutlen);
+        modesPushOutput(modesDecode::Modes.rawout, modesDecode::Modes.rawoutlen);
+        modesUdpOutput(modesDecode::Modes.rawout, modesDecode::Modes.rawoutlen);
+        modesDecode::Modes.rawoutlen = 0;
+    }
+    if (modesDecode::Modes.sbsoutlen) {
+        modesSendAllClients(modesDecode::Modes.sbsos, modesDecode::Modes.sbsout,
+                            modesDecode::Modes.sbsoutlen);
+        modesDecode::Modes.sbsoutlen = 0;
+    }
+    if (modesDecode::Modes.filtered_len) {
+        ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+        for (j = 0; j < modesDecode::Modes.filtered_len; j++)
+            flushFiltered(modesDecode::Modes.filtered[j]);
+        ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+    }
 }
 
+/* Evaluate the filters of the clients of a given service against the
+ * message, marking the clients that want it, before the message is
+ * formatted. If 'mm' is NULL the message is for every client. Returns the
+ * number of clients, with or without a filter, that want the message. */
+static int selectClients(int service, struct modesMessage *mm,
+                         struct aircraft *a) {
+    int j, wanted = *unfilteredClients(service);
+
+    if (modesDecode::Modes.filtered_len == 0) return wanted;
+    ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+    for (j = 0; j < modesDecode::Modes.filtered_len; j++) {
+        struct modes::client *c = modesDecode::Modes.filtered[j];
+
+        c->matched = c->service == service && !c->closing &&
+                     (mm == NULL || modesFilterMatch(c->filter, mm, a));
+        wanted += c->matched;
+    }
+    ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+    return wanted;
+}
+
+/* Append the specified message to the pending output of a given service,
+ * flushing first if there is not enough space left, and to the pending
+ * output of the clients with a filter selected by selectClients(). */
+void modesQueueOutput(int service, const char *msg, int len) {
+    char *buf = modesDecode::Modes.rawout;
+    int *buflen = &modesDecode::Modes.rawoutlen;
+    int j;
+
+    if (service == modesDecode::Modes.sbsos) {
+        buf = modesDecode::Modes.sbsout;
+        buflen = &modesDecode::Modes.sbsoutlen;
+    }
+    if (*buflen + len > modesDecode::MODES_NET_OUT_BUF_SIZE)
+        modesFlushOutputs();
+    ::memcpy(buf + *buflen, msg, len);
+    *buflen += len;
+
+    if (modesDecode::Modes.filtered_len == 0) return;
+    ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+    for (j = 0; j < modesDecode::Modes.filtered_len; j++) {
+        struct modes::client *c = modesDecode::Modes.filtered[j];
+
+        if (c->service != service || !c->matched) continue;
+        if (c->outlen + len > modesDecode::MODES_NET_OUT_BUF_SIZE)
+            flushFiltered(c);
+        ::memcpy(c->out + c->outlen, msg, len);
+        c->outlen += len;
+    }
+    ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+}
 
 void sendSync(void)
   {
     static int counter = 0;
-    static struct tms cpu_time;
 
     if (counter%1024 == 0)
       {
         counter = 1;
-        time_t global_time = ::time(NULL);
-        long  msTime = mstime();
-        clock_t relative_time = ::times(&cpu_time);
+        time_t global_time = modesClockSec();
+        long  msTime = modesClockMs();
+        char stamp[modesDecode::MODES_TIME_STR_LEN];
 
         char msg[225];
         msg[224] = '\0';
-        ::snprintf(msg, 223, "SYNC %lds %ldms %ldtks:\n", 
-                   global_time, msTime, relative_time);
+        modesFormatTime(stamp, modesDecode::Modes.clock.samples);
+        ::snprintf(msg, 223, "SYNC %lds %ldms %ssmp:\n",
+                   global_time, msTime, stamp);
 
-        modesSendAllClients(modesDecode::Modes.ros, msg, ::strlen(msg));
+        selectClients(modesDecode::Modes.ros, NULL, NULL);
+        modesQueueOutput(modesDecode::Modes.ros, msg, ::strlen(msg));
       }
     else counter++;
   }
 
 
 /* Write raw output to TCP clients. */
- void modesSendRawOutput(const clock_t *time, struct modeSMessage::modesMessage *mm) {
+ void modesSendRawOutput(const uint64_t *time, struct modeSMessage::modesMessage *mm,
+                         struct aircraft *a) {
    sendSync();
 
+    /* The raw output is always wanted by the pushed and UDP outputs. */
+    if (!selectClients(modesDecode::Modes.ros, mm, a) &&
+        !modesDecode::Modes.push_count && !modesDecode::Modes.udp.count)
+        return;
+
     char msg[224], *p = msg;
-    ::snprintf(p, 223, "%ld*", *time);
-    p = ::strstr(p, "*"); p++;
+    p += modesFormatTime(p, *time);
+    *p++ = '*';
     for (int j = 0; j < mm->msgbits/8; j++) {
         ::sprintf(p, "%02X", mm->msg[j]);
         p += 2;
     }
     *p++ = ';';
     *p++ = '\n';
-    modesSendAllClients(modesDecode::Modes.ros, msg, p-msg);
+    modesQueueOutput(modesDecode::Modes.ros, msg, p-msg);
 }
 
 
@@ -280,6 +599,9 @@ void modesSendSBSOutput(struct modeSMessage::modesMessage *mm, struct aircraft *
     char msg[256], *p = msg;
     int emergency = 0, ground = 0, alert = 0, spi = 0;
 
+    if (!selectClients(modesDecode::Modes.sbsos, mm, a)) return;
+    modesDecode::decodeModesFields(mm);
+
     if (mm->msgtype == 4 || mm->msgtype == 5 || mm->msgtype == 21) {
         /* Node: identity is calculated/kept in base10 but is actually
          * octal (07500 is represented as 7500) */
@@ -304,7 +626,7 @@ void modesSendSBSOutput(struct modeSMessage::modesMessage *mm, struct aircraft *
         mm->aa1, mm->aa2, mm->aa3);
     } else if (mm->msgtype == 17 && mm->metype == 4) {
         p += ::sprintf(p, "MSG,1,,,%02X%02X%02X,,,,,,%s,,,,,,,,0,0,0,0",
-        mm->aa1, mm->aa2, mm->aa3, mm->flight);
+        mm->aa1, mm->aa2, mm->aa3, mm->me.ident.flight);
     } else if (mm->msgtype == 17 && mm->metype >= 9 && mm->metype <= 18) {
         if (a->lat == 0 && a->lon == 0)
             p += ::sprintf(p, "MSG,3,,,%02X%02X%02X,,,,,,,%d,,,,,,,0,0,0,0",
@@ -314,7 +636,7 @@ void modesSendSBSOutput(struct modeSMessage::modesMessage *mm, struct aircraft *
                             "0,0,0,0",
             mm->aa1, mm->aa2, mm->aa3, mm->altitude, a->lat, a->lon);
     } else if (mm->msgtype == 17 && mm->metype == 19 && mm->mesub == 1) {
-        int vr = (mm->vert_rate_sign==0?1:-1) * (mm->vert_rate-1) * 64;
+        int vr = (mm->me.vel.vert_rate_sign==0?1:-1) * (mm->me.vel.vert_rate-1) * 64;
 
         p += ::sprintf(p, "MSG,4,,,%02X%02X%02X,,,,,,,,%d,%d,,,%i,,0,0,0,0",
         mm->aa1, mm->aa2, mm->aa3, a->speed, a->heading, vr);
@@ -326,7 +648,7 @@ void modesSendSBSOutput(struct modeSMessage::modesMessage *mm, struct aircraft *
     }
 
     *p++ = '\n';
-    modesSendAllClients(modesDecode::Modes.sbsos, msg, p-msg);
+    modesQueueOutput(modesDecode::Modes.sbsos, msg, p-msg);
 }
 
 
@@ -335,19 +657,36 @@ void modesSendSBSOutput(struct modeSMessage::modesMessage *mm, struct aircraft *
 struct modeSMessage::aircraft*
 interactiveReceiveData(struct modeSMessage::modesMessage *mm) {
     uint32_t addr;
-    struct aircraft *a, *aux;
-    time_t now = ::time(NULL);
+    struct aircraft *a;
+    time_t now = modesClockSec();
 
     if (modesDecode::Modes.check_crc && mm->crcok == 0) return NULL;
+    modesDecode::decodeModesFields(mm);
     addr = (mm->aa1 << 16) | (mm->aa2 << 8) | mm->aa3;
 
+    /* The HTTP server reads the list from the network thread. */
+    ::pthread_mutex_lock(&modesDecode::Modes.aircrafts_mutex);
+
     /* Loookup our aircraft or create a new one. */
     a = interactiveFindAircraft(addr);
     if (!a) {
+        if (!interactiveAdmitAircraft(addr, mm, now)) {
+            ::pthread_mutex_unlock(&modesDecode::Modes.aircrafts_mutex);
+            return NULL;
+        }
+        if (modesDecode::Modes.aircraft_pool.in_use >=
+            modesDecode::Modes.max_aircrafts)
+            interactiveEvictAircraft();
         a = interactiveCreateAircraft(addr);
-        a->next = modesDecode::Modes.aircrafts;
-        modesDecode::Modes.aircrafts = a;
+        aircraftLinkHead(a);
+        aircraftLruLinkHead(a);
+        aircraftScheduleExpiry(a);
     } else {
+        if (modesDecode::Modes.lru_head != a) {
+            aircraftLruUnlink(a);
+            aircraftLruLinkHead(a);
+        }
+
         /* If it is an already known aircraft, move it on head
          * so we keep aircrafts ordered by received message time.
          *
@@ -356,18 +695,17 @@ interactiveReceiveData(struct modeSMessage::modesMessage *mm) {
          * othewise with multiple aircrafts at the same time we have an
          * useless shuffle of positions on the screen. */
       if (0 && modesDecode::Modes.aircrafts != a && (now - a->seen) >= 1) {
-            aux = modesDecode::Modes.aircrafts;
-            while(aux->next != a) aux = aux->next;
-            /* Now we are a node before the aircraft to remove. */
-            aux->next = aux->next->next; /* removed. */
-            /* Add on head */
-            a->next = modesDecode::Modes.aircrafts;
-            modesDecode::Modes.aircrafts = a;
+            aircraftUnlink(a);
+            aircraftLinkHead(a);
         }
     }
 
     a->seen = now;
     a->messages++;
+    if (mm->signal) {
+        a->signal = a->signal ? (a->signal*7 + mm->signal)/8 : mm->signal;
+        if (mm->signal > a->signal_peak) a->signal_peak = mm->signal;
+    }
 
     if (mm->msgtype == 0 || mm->msgtype == 4 || mm->msgtype == 20) {
         a->altitude = mm->altitude;
@@ -375,17 +713,17 @@ interactiveReceiveData(struct modeSMessage::modesMessage *mm) {
       a->identity = mm->identity;
     } else if (mm->msgtype == 17) {
         if (mm->metype >= 1 && mm->metype <= 4) {
-            memcpy(a->flight, mm->flight, sizeof(a->flight));
+            memcpy(a->flight, mm->me.ident.flight, sizeof(a->flight));
         } else if (mm->metype >= 9 && mm->metype <= 18) {
             a->altitude = mm->altitude;
-            if (mm->fflag) {
-                a->odd_cprlat = mm->raw_latitude;
-                a->odd_cprlon = mm->raw_longitude;
-                a->odd_cprtime = mstime();
+            if (mm->me.pos.fflag) {
+                a->odd_cprlat = mm->me.pos.raw_latitude;
+                a->odd_cprlon = mm->me.pos.raw_longitude;
+                a->odd_cprtime = modesClockMonoMs();
             } else {
-                a->even_cprlat = mm->raw_latitude;
-                a->even_cprlon = mm->raw_longitude;
-                a->even_cprtime = mstime();
+                a->even_cprlat = mm->me.pos.raw_latitude;
+                a->even_cprlon = mm->me.pos.raw_longitude;
+                a->even_cprtime = modesClockMonoMs();
             }
             /* If the two data is less than 10 seconds apart, compute
              * the position. */
@@ -394,26 +732,27 @@ interactiveReceiveData(struct modeSMessage::modesMessage *mm) {
             }
         } else if (mm->metype == 19) {
             if (mm->mesub == 1 || mm->mesub == 2) {
-                a->speed = mm->velocity;
-                a->heading = mm->heading;
-                a->rateOfClimb = (mm->vert_rate_sign==0?1:-1) * (mm->vert_rate-1) * 64;
+                a->speed = mm->me.vel.velocity;
+                a->heading = mm->me.vel.heading;
+                a->rateOfClimb = (mm->me.vel.vert_rate_sign==0?1:-1) * (mm->me.vel.vert_rate-1) * 64;
             }
         }
     }
+    ::pthread_mutex_unlock(&modesDecode::Modes.aircrafts_mutex);
     return a;
 }
 
 /* Show the currently captured interactive data on screen. */
 void interactiveShowData(void) {
     struct aircraft *a = modesDecode::Modes.aircrafts;
-    time_t now = ::time(NULL);
+    time_t now = modesClockSec();
     int count = 0;
 
 #ifndef RADAR_OUTPUT
     char progress[4];
     progress[3] = '\0';
     ::memset(progress,' ',3);
-    progress[::time(NULL)%3] = '.';
+    progress[now%3] = '.';
 
     ::printf("\x1b[H\x1b[2J");    /* Clear the screen */
     ::printf(
@@ -479,33 +818,66 @@ void interactiveShowData(void) {
 }
 
 /* When in interactive mode If we don't receive new nessages within
- * MODES_INTERACTIVE_TTL seconds we remove the aircraft from the list. */
+ * MODES_INTERACTIVE_TTL seconds we remove the aircraft from the list.
+ *
+ * Instead of walking the whole list, aircrafts are kept in a timer wheel
+ * of MODES_EXPIRY_WHEEL_SIZE one second slots, filed under the second
+ * they would expire at if no other message is received. Receiving a
+ * message doesn't move the aircraft: when its slot is due the aircraft
+ * is either removed or filed again according to the last message, so
+ * every pass only touches the aircrafts that may have expired. */
 void interactiveRemoveStaleAircrafts(void) {
-    struct modeSMessage::aircraft *a = modesDecode::Modes.aircrafts;
-    struct modeSMessage::aircraft *prev = NULL;
-    time_t now = ::time(NULL);
-
-    while(a) {
-      if (::abs(now - a->seen) > modesDecode::Modes.interactive_ttl) {
-            struct modeSMessage::aircraft *next = a->next;
-            /* Remove the element from the linked list, with care
-             * if we are removing the first element. */
-            ::free(a);
-            if (!prev)
-                modesDecode::Modes.aircrafts = next;
-            else
-                prev->next = next;
+    time_t now = modesClockSec();
+    int steps = 0;
+
+    if (modesDecode::Modes.expiry_time > now) return;
+    ::pthread_mutex_lock(&modesDecode::Modes.aircrafts_mutex);
+    while (modesDecode::Modes.expiry_time <= now &&
+           steps++ < modesDecode::MODES_EXPIRY_WHEEL_SIZE) {
+        int slot = modesDecode::Modes.expiry_time %
+                   modesDecode::MODES_EXPIRY_WHEEL_SIZE;
+        struct modeSMessage::aircraft *a = modesDecode::Modes.expiry[slot];
+
+        modesDecode::Modes.expiry[slot] = NULL;
+        while (a) {
+            struct modeSMessage::aircraft *next = a->expiry_next;
+
+            if (::abs(now - a->seen) > modesDecode::Modes.interactive_ttl) {
+                aircraftLruUnlink(a);
+                aircraftUnlink(a);
+                aircraftPoolFree(a);
+            } else {
+                aircraftScheduleExpiry(a);
+            }
             a = next;
-        } else {
-            prev = a;
-            a = a->next;
         }
+        modesDecode::Modes.expiry_time++;
     }
+    /* After a long pause every slot was processed once, that's enough. */
+    if (modesDecode::Modes.expiry_time <= now)
+        modesDecode::Modes.expiry_time = now+1;
+    ::pthread_mutex_unlock(&modesDecode::Modes.aircrafts_mutex);
 }
 
-/* This function gets called from time to time when the decoding thread is
- * awakened by new data arriving. This usually happens a few times every
- * second. */
+/* Make room in the clients table for the specified fd. The caller must
+ * hold Modes.clients_mutex. Returns -1 on out of memory. */
+static int growClients(int fd) {
+    int len = modesDecode::Modes.clients_len;
+    struct modes::client **clients;
+
+    while (len <= fd) len *= 2;
+    clients = (struct modes::client**)
+      ::realloc(modesDecode::Modes.clients, sizeof(*clients)*len);
+    if (clients == NULL) return -1;
+    ::memset(clients+modesDecode::Modes.clients_len, 0,
+             sizeof(*clients)*(len-modesDecode::Modes.clients_len));
+    modesDecode::Modes.clients = clients;
+    modesDecode::Modes.clients_len = len;
+    return 0;
+}
+
+/* Accept the pending connections on all the listening sockets. Called by
+ * the network thread when one of them is readable. */
 void modesAcceptClients(void) {
     int fd, port;
     unsigned int j;
@@ -521,22 +893,35 @@ void modesAcceptClients(void) {
         fd = anetTcpAccept(modesDecode::Modes.aneterr, services[j], NULL, &port);
         if (fd == -1) continue;
 
-        if (fd >= modesDecode::MODES_NET_MAX_FD) {
-            close(fd);
-            return; /* Max number of clients reached. */
-        }
-
         anetNonBlock(modesDecode::Modes.aneterr, fd);
         c = (struct modes::client*)::malloc(sizeof(*c));
+        if (c == NULL) {
+            close(fd);
+            return;
+        }
         c->service = services[j];
         c->fd = fd;
-        c->buflen = 0;
-        modesDecode::Modes.clients[fd] = c;
+        c->in = NULL; /* Allocated by the first read. */
+        c->filter = NULL;
+        c->out = NULL;
+        c->outlen = 0;
+        c->matched = 0;
+        c->closing = 0;
         anetSetSendBuffer(modesDecode::Modes.aneterr, fd,
                           modesDecode::MODES_NET_SNDBUF_SIZE);
 
+        ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+        if (fd >= modesDecode::Modes.clients_len && growClients(fd) == -1) {
+            ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+            ::free(c);
+            close(fd);
+            return; /* Out of memory. */
+        }
+        modesDecode::Modes.clients[fd] = c;
+        if (unfilteredClients(c->service)) (*unfilteredClients(c->service))++;
         if (modesDecode::Modes.maxfd < fd) 
           modesDecode::Modes.maxfd = fd;
+        ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
         if (services[j] == modesDecode::Modes.sbsos) 
           modesDecode::Modes.stat_sbs_connections++;
 
@@ -548,39 +933,154 @@ void modesAcceptClients(void) {
 }
 
 
-/* Read data from clients. This function actually delegates a lower-level
+/* Install the filter line sent by a client of an output service. Invalid
+ * lines are ignored, an empty line removes the filter. */
+static int handleFilterLine(struct modes::client *c, char *line) {
+    struct clientFilter *f, *old;
+    char *out = NULL;
+    int err, *unfiltered = unfilteredClients(c->service);
+
+    f = modesCompileFilter(line, &err);
+    if (err) {
+        if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
+            ::printf("Client %d: invalid filter: %s\n", c->fd, line);
+        return 0;
+    }
+    if (f && !c->out &&
+        (out = (char*)::malloc(modesDecode::MODES_NET_OUT_BUF_SIZE)) == NULL) {
+        modesFreeFilter(f);
+        return 0;
+    }
+
+    ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+    old = c->filter;
+    if (out) c->out = out;
+    if (f && !old) {
+        if (modesDecode::Modes.filtered_len == modesDecode::Modes.filtered_size) {
+            int size = modesDecode::Modes.filtered_size ?
+                       modesDecode::Modes.filtered_size*2 : 16;
+            struct modes::client **filtered = (struct modes::client**)
+              ::realloc(modesDecode::Modes.filtered, sizeof(c)*size);
+
+            if (filtered == NULL) {
+                ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+                modesFreeFilter(f);
+                return 0;
+            }
+            modesDecode::Modes.filtered = filtered;
+            modesDecode::Modes.filtered_size = size;
+        }
+        modesDecode::Modes.filtered[modesDecode::Modes.filtered_len++] = c;
+        (*unfiltered)--;
+    } else if (!f && old) {
+        flushFiltered(c);
+        removeFiltered(c);
+        (*unfiltered)++;
+    }
+    c->filter = f;
+    c->matched = 0;
+    ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+    modesFreeFilter(old);
+
+    if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
+        ::printf("Client %d: filter %s\n", c->fd, f ? line : "removed");
+    return 0;
+}
+
+/* Read data from a client. This function actually delegates a lower-level
  * function that depends on the kind of service (raw, http, ...). */
-void modesReadFromClients(void) {
-    int j;
-    struct modes::client *c;
+static void modesReadFromClient(int fd) {
+    /* Only this thread changes the clients table, no need to lock it. */
+    struct modes::client *c = modesDecode::Modes.clients[fd];
+
+    if (c == NULL) return;
+    if (c->service == modesDecode::Modes.ris)
+      modes::modesReadFromClient(c,(char*)"\n",modes::decodeHexMessage);
+    else if (c->service == modesDecode::Modes.https)
+      modes::modesReadFromClient(c,(char*)"\r\n\r\n",modes::handleHTTPRequest);
+    else
+      modes::modesReadFromClient(c,(char*)"\n",handleFilterLine);
+}
 
-    for (j = 0; j <= modesDecode::Modes.maxfd; j++) {
-        if ((c = modesDecode::Modes.clients[j]) == NULL) continue;
-        if (c->service == modesDecode::Modes.ris)
-          modes::modesReadFromClient(c,(char*)"\n",modes::decodeHexMessage);
-        else if (c->service == modesDecode::Modes.https)
-          modes::modesReadFromClient(c,(char*)"\r\n\r\n",modes::handleHTTPRequest);
+/* The network thread. Everything related to the network except writing
+ * the output (accepting clients, reading raw input and serving HTTP
+ * requests) is handled here as soon as the sockets become readable, so
+ * raw input frames are handed to the decoder thread without waiting for
+ * the next block of samples. */
+void *netThreadEntryPoint(void *arg) {
+    struct pollfd *fds = NULL;
+    int fdslen = 0;
+    (void)arg;
+
+    while (1) {
+        int j, n = 0, listeners, push, npush;
+        int timeout = modesDecode::MODES_NET_POLL_MS, len;
+
+        ::pthread_mutex_lock(&modesDecode::Modes.clients_mutex);
+        len = modesDecode::Modes.maxfd+1+4+modesDecode::Modes.push_count;
+        if (fdslen < len) {
+            struct pollfd *newfds = (struct pollfd*)
+              ::realloc(fds, sizeof(*fds)*len);
+
+            if (newfds == NULL) {
+                /* Out of memory: keep the old table and try again
+                 * later, the clients are served once it succeeds. */
+                ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+                ::poll(NULL, 0, timeout);
+                continue;
+            }
+            fds = newfds;
+            fdslen = len;
+        }
+        fds[n++].fd = modesDecode::Modes.ros;
+        fds[n++].fd = modesDecode::Modes.ris;
+        fds[n++].fd = modesDecode::Modes.https;
+        fds[n++].fd = modesDecode::Modes.sbsos;
+        listeners = n;
+        for (j = 0; j <= modesDecode::Modes.maxfd; j++)
+            if (modesDecode::Modes.clients[j]) fds[n++].fd = j;
+        ::pthread_mutex_unlock(&modesDecode::Modes.clients_mutex);
+
+        for (j = 0; j < n; j++) {
+            fds[j].events = POLLIN;
+            fds[j].revents = 0;
+        }
+        push = n;
+        npush = modesPushPollFds(fds+push, &timeout);
+        j = ::poll(fds, push+npush, timeout);
+        modesClockTick();
+        if (j <= 0) continue;
+
+        modesPushHandleEvents(fds+push, npush);
+        for (j = listeners; j < n; j++)
+            if (fds[j].revents) modesReadFromClient(fds[j].fd);
+        for (j = 0; j < listeners; j++) {
+            if (fds[j].revents) {
+                modesAcceptClients();
+                break;
+            }
+        }
     }
+    return NULL;
 }
 
 
-/* This function is called a few times every second by main in order to
- * perform tasks we need to do continuously, like accepting new clients
- * from the net, refreshing the screen in interactive mode, and so forth. */
+/* This function is called a few times every second by the decoder thread
+ * in order to perform tasks we need to do continuously, like removing
+ * stale aircrafts, refreshing the screen in interactive mode, and so
+ * forth. */
 void backgroundTasks(void) {
-    if (modesDecode::Modes.net) {
-        modesAcceptClients();
-        modesReadFromClients();
+    modesClockTick();
+    if (modesDecode::Modes.net || modesDecode::Modes.interactive) {
         interactiveRemoveStaleAircrafts();
     }
 
     /* Refresh screen when in interactive mode. */
-    long msTime = mstime();
+    long msTime = modesClockMonoMs();
     if (modesDecode::Modes.interactive == 1 &&
         ::abs(msTime - modesDecode::Modes.interactive_last_update) >
         modesDecode::MODES_INTERACTIVE_REFRESH_TIME)
     {
-        interactiveRemoveStaleAircrafts();
         interactiveShowData();
         modesDecode::Modes.interactive_last_update = msTime;
     }
@@ -7,7 +7,6 @@
 
 extern "C" {
 #include <stdint.h>
-#include <sys/times.h>
 }
 
 namespace modeSMessage {
@@ -25,6 +24,8 @@ struct aircraft {
     int heading;          /* Angle of flight. */
     time_t seen;        /* Time at which the last packet was received. */
     long messages;      /* Number of Mode S messages received. */
+    int signal;         /* Running average of the messages magnitude. */
+    int signal_peak;    /* Highest message magnitude. */
     /* Encoded latitude and longitude as extracted by odd and even
      * CPR encoded messages. */
     int odd_cprlat;
@@ -34,58 +35,107 @@ struct aircraft {
     double lat, lon;    /* Coordinates obtained from CPR encoded data. */
     long odd_cprtime, even_cprtime;
     struct aircraft *next; /* Next aircraft in our linked list. */
+    struct aircraft *prev; /* Previous one, for O(1) removal. */
+    struct aircraft *expiry_next; /* Next in the same expiry wheel slot. */
+    int expiry_slot;       /* Expiry wheel slot the aircraft is in. */
+    struct aircraft *lru_next; /* Least recently seen order, to evict. */
+    struct aircraft *lru_prev;
 };
 
+/* Aircraft structures are allocated in slabs of MODES_AIRCRAFT_SLAB, and
+ * recycled through a free list (linked by 'next') instead of being
+ * returned to the heap, so that tracking doesn't churn the heap and the
+ * aircrafts are stored close to each other. Slabs are never freed. */
+struct aircraftSlab {
+    struct aircraftSlab *next;
+    struct aircraft items[modesDecode::MODES_AIRCRAFT_SLAB];
+};
+
+struct aircraftPool {
+    struct aircraftSlab *slabs;     /* All the slabs allocated. */
+    struct aircraft *free;          /* Free list. */
+    long slabs_count;
+    long in_use;                    /* Aircrafts currently allocated. */
+    long peak;                      /* Highest in_use seen. */
+    long allocs;                    /* Total allocations. */
+    long frees;                     /* Total aircrafts returned. */
+};
 
 
-/* The struct we use to store information about a decoded message. */
+
+/* The struct we use to store information about a decoded message.
+ *
+ * It is created for every demodulated frame and passed around by value,
+ * so it is kept compact (it fits a single cache line): every field uses
+ * the narrowest type able to hold it, and the extended squitter fields,
+ * that are mutually exclusive, share storage in a union selected by
+ * msgtype == 17 and metype. */
 struct modesMessage {
     /* Generic fields */
     unsigned char msg[modesDecode::MODES_LONG_MSG_BYTES]; /* Binary message. */
-    int msgbits;                /* Number of bits in message */
-    int msgtype;                /* Downlink format # */
-    int crcok;                  /* True if CRC was valid */
+    uint8_t msgbits;            /* Number of bits in message */
+    uint8_t msgtype;            /* Downlink Format # */
+    uint8_t aa1, aa2, aa3;      /* ICAO Address bytes 1 2 and 3 */
+    unsigned crcok:1;           /* True if CRC was valid */
+    unsigned phase_corrected:1; /* True if phase correction was applied. */
+    unsigned decoded:1;         /* True once decodeModesFields() ran. */
+    unsigned unit:1;            /* Altitude unit, MODES_UNIT_FEET/METERS. */
+    unsigned flipped:2;         /* Weak bits flipped by the soft fix. */
+    unsigned ap_fixed:1;        /* AP bit error fixed with the ICAO cache. */
+    int16_t errorbit;           /* Bit corrected. -1 if no bit corrected. */
     uint32_t crc;               /* Message CRC */
-    int errorbit;               /* Bit corrected. -1 if no bit corrected. */
-    int aa1, aa2, aa3;          /* ICAO Address bytes 1 2 and 3 */
-    int phase_corrected;        /* True if phase correction was applied. */
 
     /* DF 11 */
-    int ca;                     /* Responder capabilities. */
-
-    /* DF 17 */
-    int metype;                 /* Extended squitter message type. */
-    int mesub;                  /* Extended squitter message subtype. */
-    int heading_is_valid;
-    int heading;
-    int aircraft_type;
-    int fflag;                  /* 1 = Odd, 0 = Even CPR message. */
-    int tflag;                  /* UTC synchronized? */
-    int raw_latitude;           /* Non decoded latitude */
-    int raw_longitude;          /* Non decoded longitude */
-    char flight[9];             /* 8 chars flight number. */
-    int ew_dir;                 /* 0 = East, 1 = West. */
-    int ew_velocity;            /* E/W velocity. */
-    int ns_dir;                 /* 0 = North, 1 = South. */
-    int ns_velocity;            /* N/S velocity. */
-    int vert_rate_source;       /* Vertical rate source. */
-    int vert_rate_sign;         /* Vertical rate sign. */
-    int vert_rate;              /* Vertical rate. */
-    int velocity;               /* Computed from EW and NS velocity. */
+    uint8_t ca;                 /* Responder capabilities. */
 
     /* DF4, DF5, DF20, DF21 */
-    int fs;                     /* Flight status for DF4,5,20,21 */
-    int dr;                     /* Request extraction of downlink request. */
-    int um;                     /* Request extraction of downlink request. */
-    int identity;               /* 13 bits identity (Squawk). */
+    uint8_t fs;                 /* Flight status for DF4,5,20,21 */
+    uint8_t dr;                 /* Request extraction of downlink request. */
+    uint8_t um;                 /* Request extraction of downlink request. */
+    int16_t identity;           /* 13 bits identity (Squawk). */
+    uint16_t signal;            /* Average pulse magnitude, 0 if unknown. */
 
     /* Fields used by multiple message types. */
-    int altitude, unit;
+    int32_t altitude;
+
+    /* DF 17 */
+    uint8_t metype;             /* Extended squitter message type. */
+    uint8_t mesub;              /* Extended squitter message subtype. */
+    union {
+        /* metype 1 to 4: Aircraft Identification and Category */
+        struct {
+            uint8_t aircraft_type;
+            char flight[9];     /* 8 chars flight number. */
+        } ident;
+        /* metype 9 to 18: Airborne position */
+        struct {
+            uint8_t fflag;      /* Odd (non zero) or Even CPR message. */
+            uint8_t tflag;      /* UTC synchronized? */
+            int32_t raw_latitude;  /* Non decoded latitude */
+            int32_t raw_longitude; /* Non decoded longitude */
+        } pos;
+        /* metype 19: Airborne velocity (subtypes 1 and 2) and heading
+         * (subtypes 3 and 4). */
+        struct {
+            uint8_t ew_dir;     /* 0 = East, 1 = West. */
+            uint8_t ns_dir;     /* 0 = North, 1 = South. */
+            uint8_t vert_rate_source; /* Vertical rate source. */
+            uint8_t vert_rate_sign;   /* Vertical rate sign. */
+            uint8_t heading_is_valid;
+            int16_t ew_velocity;      /* E/W velocity. */
+            int16_t ns_velocity;      /* N/S velocity. */
+            int16_t vert_rate;        /* Vertical rate. */
+            int16_t velocity;   /* Computed from EW and NS velocity. */
+            int16_t heading;
+        } vel;
+    } me;
 };
 
- long mstime();
+ long ustime();
  void modesSendSBSOutput(struct modeSMessage::modesMessage *mm, struct aircraft *a);
- void modesSendRawOutput(const clock_t *time, struct modeSMessage::modesMessage *mm);
+ void modesSendRawOutput(const uint64_t *time, struct modeSMessage::modesMessage *mm,
+                         struct aircraft *a);
+ void modesFlushOutputs(void);
  struct aircraft* interactiveFindAircraft(uint32_t addr);
  struct aircraft* interactiveReceiveData(struct modeSMessage::modesMessage *mm);
  void interactiveShowData(void) ;
@@ -94,6 +144,13 @@ struct modesMessage {
 
  void backgroundTasks(void);
 
+ /* Print the aircraft pool memory usage and the admission statistics. */
+ void trackerShowStats(void);
+
+ /* The network thread: accepts clients, reads the raw input and serves
+  * the HTTP requests. */
+ void *netThreadEntryPoint(void *arg);
+
 } // namespace
 
 
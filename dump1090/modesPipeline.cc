@@ -0,0 +1,207 @@
+
+#include "modesPipeline.h"
+#include "modesDecode.h"
+#include "modesMessage.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+}
+
+namespace modesDecode {
+
+void modesInitPipeline(void) {
+    struct modesPipeline *p = &Modes.pipeline;
+
+    p->slots = (struct modesBatch*)
+      ::malloc(sizeof(struct modesBatch)*MODES_PIPELINE_DEPTH);
+    p->netin = (struct modesBatch*)::malloc(sizeof(struct modesBatch));
+    p->netout = (struct modesBatch*)::malloc(sizeof(struct modesBatch));
+    if (p->slots == NULL || p->netin == NULL || p->netout == NULL) {
+        ::fprintf(stderr, "Out of memory allocating the pipeline.\n");
+        ::exit(1);
+    }
+    p->slots[0].len = 0;
+    p->netin->len = p->netout->len = 0;
+    p->head = p->tail = 0;
+    p->done = 0;
+    /* Reading from file we can slow down the reader instead of losing
+     * data. */
+    p->blocking = Modes.ifilename != NULL || Modes.rfilename != NULL;
+    ::pthread_mutex_init(&p->mutex,NULL);
+    ::pthread_cond_init(&p->data_cond,NULL);
+    ::pthread_cond_init(&p->space_cond,NULL);
+
+    p->stat_batches = 0;
+    p->stat_dropped_batches = 0;
+    p->stat_dropped_msgs = 0;
+    p->stat_occupancy_sum = 0;
+    p->stat_occupancy_max = 0;
+    p->stat_demod_us = 0;
+    p->stat_decode_us = 0;
+    p->stat_start_us = modeSMessage::ustime();
+    p->stat_net_msgs = 0;
+    p->stat_net_dropped = 0;
+}
+
+struct modesBatch *modesPipelineBatch(void) {
+    return &Modes.pipeline.slots[Modes.pipeline.head % MODES_PIPELINE_DEPTH];
+}
+
+/* Producer side. */
+void modesPipelinePush(void) {
+    struct modesPipeline *p = &Modes.pipeline;
+    struct modesBatch *batch = modesPipelineBatch();
+    long occupancy;
+
+    /* The slot after head must not be still owned by the consumer. */
+    if (p->head + 1 - p->tail >= (unsigned int)MODES_PIPELINE_DEPTH) {
+        if (!p->blocking) {
+            p->stat_dropped_batches++;
+            p->stat_dropped_msgs += batch->len;
+            batch->len = 0;
+            return;
+        }
+        ::pthread_mutex_lock(&p->mutex);
+        while (p->head + 1 - p->tail >= (unsigned int)MODES_PIPELINE_DEPTH)
+            ::pthread_cond_wait(&p->space_cond,&p->mutex);
+        ::pthread_mutex_unlock(&p->mutex);
+    }
+
+    /* Make sure the batch content is visible before the new head. */
+    __sync_synchronize();
+    p->head++;
+    modesPipelineBatch()->len = 0;
+
+    occupancy = p->head - p->tail;
+    p->stat_batches++;
+    p->stat_occupancy_sum += occupancy;
+    if (occupancy > p->stat_occupancy_max) p->stat_occupancy_max = occupancy;
+
+    ::pthread_mutex_lock(&p->mutex);
+    ::pthread_cond_signal(&p->data_cond);
+    ::pthread_mutex_unlock(&p->mutex);
+}
+
+void modesPipelinePushNet(const uint64_t *time,
+                          struct modeSMessage::modesMessage *mm) {
+    struct modesPipeline *p = &Modes.pipeline;
+    struct modesBatch *batch;
+
+    ::pthread_mutex_lock(&p->mutex);
+    batch = p->netin;
+    p->stat_net_msgs++;
+    if (batch->len == MODES_BATCH_LEN) {
+        p->stat_net_dropped++;
+    } else {
+        batch->times[batch->len] = *time;
+        batch->msgs[batch->len++] = *mm;
+        /* The decoder thread may only be sleeping if it was empty. */
+        if (batch->len == 1) ::pthread_cond_signal(&p->data_cond);
+    }
+    ::pthread_mutex_unlock(&p->mutex);
+}
+
+void modesPipelineStop(void) {
+    struct modesPipeline *p = &Modes.pipeline;
+
+    modesPipelinePush();
+    ::pthread_mutex_lock(&p->mutex);
+    p->done = 1;
+    ::pthread_cond_signal(&p->data_cond);
+    ::pthread_mutex_unlock(&p->mutex);
+    ::pthread_join(p->decoder_thread, NULL);
+}
+
+/* Consumer side. */
+void *decoderThreadEntryPoint(void *arg) {
+    struct modesPipeline *p = &Modes.pipeline;
+    (void)arg;
+
+    while (1) {
+        long start;
+
+        if (p->netin->len) {
+            struct modesBatch *batch;
+
+            ::pthread_mutex_lock(&p->mutex);
+            batch = p->netin;
+            p->netin = p->netout;
+            p->netout = batch;
+            ::pthread_mutex_unlock(&p->mutex);
+
+            start = modeSMessage::ustime();
+            decodeModesBatch(batch);
+            p->stat_decode_us += modeSMessage::ustime() - start;
+        }
+        if (p->tail != p->head) {
+            /* Make sure we see the batch content published with head. */
+            __sync_synchronize();
+            start = modeSMessage::ustime();
+            decodeModesBatch(&p->slots[p->tail % MODES_PIPELINE_DEPTH]);
+            modeSMessage::backgroundTasks();
+            p->stat_decode_us += modeSMessage::ustime() - start;
+
+            __sync_synchronize();
+            p->tail++;
+            if (p->blocking) {
+                ::pthread_mutex_lock(&p->mutex);
+                ::pthread_cond_signal(&p->space_cond);
+                ::pthread_mutex_unlock(&p->mutex);
+            }
+            continue;
+        }
+        if (p->done) break;
+
+        /* Nothing to decode: sleep until a batch is published, but wake
+         * up anyway from time to time to remove stale aircrafts and
+         * refresh the screen. */
+        ::pthread_mutex_lock(&p->mutex);
+        if (p->tail == p->head && p->netin->len == 0 && !p->done) {
+            struct timespec ts;
+            struct timeval tv;
+
+            ::gettimeofday(&tv, NULL);
+            ts.tv_sec = tv.tv_sec;
+            ts.tv_nsec = (tv.tv_usec + MODES_PIPELINE_IDLE_US) * 1000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (::pthread_cond_timedwait(&p->data_cond,&p->mutex,&ts) != 0) {
+                ::pthread_mutex_unlock(&p->mutex);
+                start = modeSMessage::ustime();
+                modeSMessage::backgroundTasks();
+                p->stat_decode_us += modeSMessage::ustime() - start;
+                continue;
+            }
+        }
+        ::pthread_mutex_unlock(&p->mutex);
+    }
+    return NULL;
+}
+
+void modesPipelineShowStats(void) {
+    struct modesPipeline *p = &Modes.pipeline;
+    long elapsed = modeSMessage::ustime() - p->stat_start_us;
+
+    if (elapsed <= 0) elapsed = 1;
+    ::printf("%ld batches, average ring occupancy %.2f, max %ld of %d\n",
+             p->stat_batches,
+             p->stat_batches ?
+               (double)p->stat_occupancy_sum/p->stat_batches : 0.0,
+             p->stat_occupancy_max, MODES_PIPELINE_DEPTH-1);
+    ::printf("%ld batches dropped (%ld messages)\n",
+             p->stat_dropped_batches, p->stat_dropped_msgs);
+    if (Modes.net)
+        ::printf("%ld messages from the network, %ld dropped\n",
+                 p->stat_net_msgs, p->stat_net_dropped);
+    ::printf("demodulation stage busy %.1f%%, decoder stage busy %.1f%%\n",
+             100.0*p->stat_demod_us/elapsed, 100.0*p->stat_decode_us/elapsed);
+}
+
+} // namespace modesDecode
@@ -0,0 +1,99 @@
+#ifndef MODESPIPELINE_H
+#define MODESPIPELINE_H
+
+#include "globals.h"
+#include "modesMessage.h"
+
+extern "C" {
+#include <pthread.h>
+#include <stdint.h>
+}
+
+namespace modesDecode {
+
+/* Messages demodulated from a block of samples, waiting to be decoded
+ * and dispatched together by decodeModesBatch(). */
+struct modesBatch {
+    uint64_t times[MODES_BATCH_LEN]; /* Time stamp of each message. */
+    int len;                        /* Number of messages in the batch. */
+    struct modeSMessage::modesMessage msgs[MODES_BATCH_LEN];
+};
+
+/* The processing pipeline:
+ *
+ *  reader thread      main thread          decoder thread
+ *  (acquisition) -->  (magnitude and  -->  (decode, tracking, output,
+ *                      demodulation)        screen)
+ *                                            ^
+ *                     network thread         |
+ *                     (clients, raw input, --+
+ *                      HTTP)
+ *
+ * The reader hands blocks of samples to the main thread as it always did.
+ * The main thread fills batches of messages and publishes them into a
+ * bounded single producer / single consumer ring of batches, that the
+ * decoder thread consumes. The ring itself is lock-free, the mutex and
+ * condition variables are only used to sleep when there is nothing to do.
+ *
+ * When the ring is full, live input drops the batch (and counts it) so
+ * that a slow consumer never stalls the demodulation, while file input
+ * waits, so that nothing is lost.
+ *
+ * Messages received by the network thread are queued into a separate
+ * batch under the mutex, and swapped with a second one by the decoder
+ * thread, so that they are decoded as soon as they arrive instead of
+ * waiting for the next block of samples. */
+struct modesPipeline {
+    struct modesBatch *slots;       /* MODES_PIPELINE_DEPTH batches. */
+    volatile unsigned int head;     /* Batch being filled by the producer. */
+    volatile unsigned int tail;     /* Next batch for the consumer. */
+    volatile int done;              /* No more batches will be published. */
+    int blocking;                   /* Wait instead of dropping when full. */
+    pthread_t decoder_thread;
+    pthread_mutex_t mutex;          /* Only used to sleep / wake up. */
+    pthread_cond_t data_cond;       /* A batch was published. */
+    pthread_cond_t space_cond;      /* A batch was consumed. */
+    struct modesBatch *netin;       /* Filled by the network thread. */
+    struct modesBatch *netout;      /* Being decoded by the decoder thread. */
+
+    /* Statistics */
+    long stat_batches;              /* Published batches. */
+    long stat_dropped_batches;      /* Batches dropped because of a full ring. */
+    long stat_dropped_msgs;         /* Messages inside the dropped batches. */
+    long stat_occupancy_sum;        /* Sum of the ring occupancy at publish. */
+    long stat_occupancy_max;        /* Highest ring occupancy seen. */
+    long stat_demod_us;             /* Time spent working by each stage. */
+    long stat_decode_us;
+    long stat_start_us;             /* When the pipeline started. */
+    long stat_net_msgs;             /* Messages received from the network. */
+    long stat_net_dropped;          /* Dropped because the decoder lagged. */
+};
+
+ void modesInitPipeline(void);
+
+ /* Return the batch the demodulator is currently filling. */
+ struct modesBatch *modesPipelineBatch(void);
+
+ /* Publish the batch currently being filled to the decoder thread, and
+  * start filling a new one. */
+ void modesPipelinePush(void);
+
+ /* Queue a message received from the network for the decoder thread. */
+ void modesPipelinePushNet(const uint64_t *time,
+                           struct modeSMessage::modesMessage *mm);
+
+ /* Publish the last batch, wait for the decoder thread to drain the ring
+  * and exit. */
+ void modesPipelineStop(void);
+
+ /* The decoder thread: consumes the published batches and performs the
+  * background tasks (stale aircrafts removal, screen refresh, ...). */
+ void *decoderThreadEntryPoint(void *arg);
+
+ /* Print the pipeline statistics. */
+ void modesPipelineShowStats(void);
+
+} // namespace
+
+
+#endif
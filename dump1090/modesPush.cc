@@ -0,0 +1,331 @@
+
+#include "modesPush.h"
+#include "modesDecode.h"
+#include "modesMessage.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <unistd.h>
+#include <sys/socket.h>
+}
+
+namespace modeSMessage {
+
+int modesAddPushTarget(const char *hostport) {
+    struct modesPushTarget **push, *t;
+    const char *colon = ::strrchr(hostport, ':');
+    char host[256], ip[32];
+    int port;
+
+    if (colon == NULL || colon == hostport ||
+        colon-hostport >= (int)sizeof(host)) return -1;
+    port = ::atoi(colon+1);
+    if (port <= 0 || port > 65535) return -1;
+    ::memcpy(host, hostport, colon-hostport);
+    host[colon-hostport] = '\0';
+    if (anetResolve(modesDecode::Modes.aneterr, host, ip) == ANET_ERR)
+        return -1;
+
+    /* The table holds pointers: a target can't move once its mutex is
+     * initialized. */
+    push = (struct modesPushTarget**)
+      ::realloc(modesDecode::Modes.push,
+                sizeof(*push)*(modesDecode::Modes.push_count+1));
+    if (push == NULL || (t = (struct modesPushTarget*)
+                         ::malloc(sizeof(*t))) == NULL) {
+        ::fprintf(stderr, "Out of memory allocating the push target.\n");
+        ::exit(1);
+    }
+    modesDecode::Modes.push = push;
+    modesDecode::Modes.push[modesDecode::Modes.push_count++] = t;
+    t->host = ::strdup(host);
+    ::strcpy(t->ip, ip);
+    t->port = port;
+    t->fd = -1;
+    t->state = MODES_PUSH_DISCONNECTED;
+    t->next_connect = 0;
+    t->connect_start = 0;
+    t->backoff = modesDecode::MODES_NET_PUSH_BACKOFF_MIN;
+    t->spool = (char*)::malloc(modesDecode::MODES_NET_PUSH_SPOOL_SIZE);
+    t->spoolstart = 0;
+    t->spoollen = 0;
+    t->partial = 0;
+    ::pthread_mutex_init(&t->mutex, NULL);
+    t->stat_connects = 0;
+    t->stat_dropped = 0;
+    if (t->host == NULL || t->spool == NULL) {
+        ::fprintf(stderr, "Out of memory allocating the push target.\n");
+        ::exit(1);
+    }
+    return 0;
+}
+
+/* Count the lines inside the specified buffer. */
+static long countLines(const char *p, int len) {
+    const char *end = p+len;
+    long lines = 0;
+
+    while ((p = (const char*)::memchr(p, '\n', end-p)) != NULL) {
+        lines++;
+        p++;
+    }
+    return lines;
+}
+
+/* Byte 'i' of the spool, counting from its first byte. */
+static char *spoolAt(struct modesPushTarget *t, int i) {
+    return t->spool +
+           (t->spoolstart + i) % modesDecode::MODES_NET_PUSH_SPOOL_SIZE;
+}
+
+/* Length of the contiguous part of the spool starting from byte 'i', up to
+ * 'len' bytes. */
+static int spoolChunk(struct modesPushTarget *t, int i, int len) {
+    int chunk = modesDecode::MODES_NET_PUSH_SPOOL_SIZE -
+                (t->spoolstart + i) % modesDecode::MODES_NET_PUSH_SPOOL_SIZE;
+
+    return chunk < len ? chunk : len;
+}
+
+/* Position of the first newline of the spool from byte 'from', or -1. */
+static int spoolFindNewline(struct modesPushTarget *t, int from) {
+    while (from < t->spoollen) {
+        int chunk = spoolChunk(t, from, t->spoollen-from);
+        char *p = spoolAt(t, from);
+        char *nl = (char*)::memchr(p, '\n', chunk);
+
+        if (nl) return from + (nl-p);
+        from += chunk;
+    }
+    return -1;
+}
+
+/* Count the lines of 'len' bytes of the spool from byte 'from'. */
+static long spoolCountLines(struct modesPushTarget *t, int from, int len) {
+    long lines = 0;
+
+    while (len > 0) {
+        int chunk = spoolChunk(t, from, len);
+
+        lines += countLines(spoolAt(t, from), chunk);
+        from += chunk;
+        len -= chunk;
+    }
+    return lines;
+}
+
+/* Remove 'len' bytes of the spool from byte 'start'. The 'start' bytes
+ * before them (at most the rest of a line being sent) are moved forward,
+ * nothing else is moved. */
+static void spoolConsume(struct modesPushTarget *t, int start, int len) {
+    int i;
+
+    for (i = start-1; i >= 0; i--) *spoolAt(t, len+i) = *spoolAt(t, i);
+    t->spoolstart = (t->spoolstart + len) % modesDecode::MODES_NET_PUSH_SPOOL_SIZE;
+    t->spoollen -= len;
+    if (t->spoollen == 0) t->spoolstart = 0;
+}
+
+/* Schedule the next connection attempt, doubling the delay every time. */
+static void pushBackoff(struct modesPushTarget *t, long now) {
+    t->next_connect = now + t->backoff;
+    t->backoff *= 2;
+    if (t->backoff > modesDecode::MODES_NET_PUSH_BACKOFF_MAX)
+        t->backoff = modesDecode::MODES_NET_PUSH_BACKOFF_MAX;
+}
+
+/* Close the connection and schedule the next attempt. The caller must hold
+ * the target mutex. */
+static void pushDisconnect(struct modesPushTarget *t) {
+    if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
+        ::printf("Push target %s:%d disconnected\n", t->host, t->port);
+
+    ::close(t->fd);
+    t->fd = -1;
+    t->state = MODES_PUSH_DISCONNECTED;
+    pushBackoff(t, modesClockMonoMs());
+
+    /* The rest of a line already partially sent is useless to the next
+     * connection. */
+    if (t->partial) {
+        int nl = spoolFindNewline(t, 0);
+
+        spoolConsume(t, 0, nl != -1 ? nl+1 : t->spoollen);
+        t->partial = 0;
+    }
+}
+
+/* Write as much of the spool as possible. The caller must hold the target
+ * mutex. */
+static void pushWrite(struct modesPushTarget *t) {
+    /* At most two writes when the spool wraps around. */
+    while (t->state == MODES_PUSH_CONNECTED && t->spoollen) {
+        int chunk = spoolChunk(t, 0, t->spoollen);
+        int nwritten = ::write(t->fd, spoolAt(t, 0), chunk);
+
+        if (nwritten > 0) {
+            t->partial = *spoolAt(t, nwritten-1) != '\n';
+            spoolConsume(t, 0, nwritten);
+            if (nwritten < chunk) break;
+        } else {
+            if (nwritten == -1 && errno != EAGAIN) pushDisconnect(t);
+            break;
+        }
+    }
+}
+
+/* Append to the spool, dropping the oldest full lines if there is not
+ * enough space. The caller must hold the target mutex. */
+static void spoolAppend(struct modesPushTarget *t, const char *buf, int len) {
+    int need = t->spoollen + len - modesDecode::MODES_NET_PUSH_SPOOL_SIZE;
+
+    if (need > 0) {
+        int start = 0, end, nl;
+
+        /* Never drop the rest of a line being sent. */
+        if (t->partial) {
+            nl = spoolFindNewline(t, 0);
+            start = nl != -1 ? nl+1 : t->spoollen;
+        }
+        end = start + need;
+        if (end > t->spoollen) end = t->spoollen;
+        if (end > start && *spoolAt(t, end-1) != '\n') {
+            nl = spoolFindNewline(t, end);
+            end = nl != -1 ? nl+1 : t->spoollen;
+        }
+        t->stat_dropped += spoolCountLines(t, start, end-start);
+        spoolConsume(t, start, end-start);
+    }
+    if (t->spoollen + len > modesDecode::MODES_NET_PUSH_SPOOL_SIZE) {
+        t->stat_dropped += countLines(buf, len);
+        return;
+    }
+    while (len > 0) {
+        int chunk = spoolChunk(t, t->spoollen, len);
+
+        ::memcpy(spoolAt(t, t->spoollen), buf, chunk);
+        t->spoollen += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+void modesPushOutput(const char *buf, int len) {
+    int j;
+
+    for (j = 0; j < modesDecode::Modes.push_count; j++) {
+        struct modesPushTarget *t = modesDecode::Modes.push[j];
+
+        ::pthread_mutex_lock(&t->mutex);
+        spoolAppend(t, buf, len);
+        pushWrite(t);
+        ::pthread_mutex_unlock(&t->mutex);
+    }
+}
+
+int modesPushPollFds(struct pollfd *fds, int *timeout) {
+    long now = modesClockMonoMs();
+    int j, n = 0;
+
+    for (j = 0; j < modesDecode::Modes.push_count; j++) {
+        struct modesPushTarget *t = modesDecode::Modes.push[j];
+
+        ::pthread_mutex_lock(&t->mutex);
+        if (t->state == MODES_PUSH_CONNECTING &&
+            now - t->connect_start > modesDecode::MODES_NET_PUSH_CONNECT_TIMEOUT)
+            pushDisconnect(t);
+
+        if (t->state == MODES_PUSH_DISCONNECTED && now >= t->next_connect) {
+            t->fd = anetTcpNonBlockConnect(modesDecode::Modes.aneterr,
+                                           t->ip, t->port);
+            if (t->fd == -1) {
+                if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
+                    ::printf("Push target %s:%d: %s\n", t->host, t->port,
+                             modesDecode::Modes.aneterr);
+                pushBackoff(t, now);
+            } else {
+                t->state = MODES_PUSH_CONNECTING;
+                t->connect_start = now;
+            }
+        }
+
+        t->pollfd = t->fd;
+        t->pollidx = -1;
+        if (t->state == MODES_PUSH_DISCONNECTED) {
+            if (t->next_connect - now < *timeout)
+                *timeout = t->next_connect - now;
+        } else {
+            t->pollidx = n;
+            fds[n].fd = t->fd;
+            fds[n].events = POLLIN;
+            if (t->state == MODES_PUSH_CONNECTING || t->spoollen)
+                fds[n].events |= POLLOUT;
+            fds[n].revents = 0;
+            n++;
+        }
+        ::pthread_mutex_unlock(&t->mutex);
+    }
+    return n;
+}
+
+void modesPushHandleEvents(struct pollfd *fds, int n) {
+    int j, k;
+
+    for (j = 0; j < modesDecode::Modes.push_count; j++) {
+        struct modesPushTarget *t = modesDecode::Modes.push[j];
+
+        ::pthread_mutex_lock(&t->mutex);
+        k = t->pollidx;
+        if (k == -1 || k >= n || fds[k].revents == 0 || t->fd != t->pollfd) {
+            /* Not polled, nothing happened, or closed by the decoder
+             * thread in the meantime. */
+        } else if (t->state == MODES_PUSH_CONNECTING) {
+            int err = 0;
+            socklen_t errlen = sizeof(err);
+
+            if (::getsockopt(t->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1
+                || err != 0) {
+                pushDisconnect(t);
+            } else {
+                if (modesDecode::Modes.debug & modesDecode::MODES_DEBUG_NET)
+                    ::printf("Push target %s:%d connected\n", t->host, t->port);
+                t->state = MODES_PUSH_CONNECTED;
+                t->backoff = modesDecode::MODES_NET_PUSH_BACKOFF_MIN;
+                t->stat_connects++;
+                anetSetSendBuffer(modesDecode::Modes.aneterr, t->fd,
+                                  modesDecode::MODES_NET_SNDBUF_SIZE);
+                pushWrite(t); /* Replay the spool. */
+            }
+        } else {
+            if (fds[k].revents & (POLLIN|POLLERR|POLLHUP)) {
+                /* We don't expect anything from the remote side, just
+                 * notice when it goes away. */
+                char buf[256];
+                int nread;
+
+                while ((nread = ::read(t->fd, buf, sizeof(buf))) > 0);
+                if (nread == 0 || errno != EAGAIN) pushDisconnect(t);
+            }
+            if (fds[k].revents & POLLOUT) pushWrite(t);
+        }
+        ::pthread_mutex_unlock(&t->mutex);
+    }
+}
+
+void modesPushShowStats(void) {
+    int j;
+
+    for (j = 0; j < modesDecode::Modes.push_count; j++) {
+        struct modesPushTarget *t = modesDecode::Modes.push[j];
+
+        ::printf("push %s:%d: %ld connections, %ld lines dropped, "
+                 "%d bytes spooled\n", t->host, t->port, t->stat_connects,
+                 t->stat_dropped, t->spoollen);
+    }
+}
+
+} // namespace
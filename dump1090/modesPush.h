@@ -0,0 +1,73 @@
+#ifndef MODESPUSH_H
+#define MODESPUSH_H
+
+#include "globals.h"
+
+extern "C" {
+#include <pthread.h>
+#include <poll.h>
+}
+
+namespace modeSMessage {
+
+/* Outbound connection pushing the raw output feed to a remote host, for
+ * receivers that can't be reached by the aggregators (--net-push).
+ *
+ * The host is resolved once, when the target is added: a slow DNS must
+ * not stall the network thread at every reconnection. The network thread
+ * connects (without blocking) and reconnects with an exponential backoff.
+ * The decoder thread appends the raw output to the spool of every target,
+ * and writes it if the target is connected: what can't be written, or is
+ * produced while disconnected, stays in the spool and is replayed after
+ * the reconnection. When the spool is full the oldest lines are dropped.
+ *
+ * The spool is a ring buffer, so that partial writes and dropped lines
+ * don't move the rest of the spool around. */
+struct modesPushTarget {
+    char *host;
+    char ip[32];                    /* Resolved address of the host. */
+    int port;
+    int fd;                         /* -1 when not connected. */
+    int state;                      /* MODES_PUSH_* */
+    long next_connect;              /* When to try again, milliseconds. */
+    long connect_start;             /* When the connection was started. */
+    long backoff;                   /* Next reconnection delay. */
+    char *spool;                    /* Output waiting to be sent. */
+    int spoolstart;                 /* Position of the first byte. */
+    int spoollen;
+    int partial;                    /* Spool starts in the middle of a line. */
+    int pollfd;                     /* fd and position in the last poll(). */
+    int pollidx;
+    pthread_mutex_t mutex;          /* Shared by network and decoder. */
+
+    /* Statistics */
+    long stat_connects;             /* Successful connections. */
+    long stat_dropped;              /* Lines dropped because of a full spool. */
+};
+
+static const int MODES_PUSH_DISCONNECTED = 0;
+static const int MODES_PUSH_CONNECTING   = 1;
+static const int MODES_PUSH_CONNECTED    = 2;
+
+ /* Add a target from a "host:port" string. Returns -1 on a bad format or
+  * if the host can't be resolved. */
+ int modesAddPushTarget(const char *hostport);
+
+ /* Append the raw output to the spool of every target and send it. */
+ void modesPushOutput(const char *buf, int len);
+
+ /* Network thread: start the due connections, and fill 'fds' with the
+  * descriptors to poll. Lowers *timeout (milliseconds) if a reconnection
+  * is due earlier. Returns the number of descriptors. */
+ int modesPushPollFds(struct pollfd *fds, int *timeout);
+
+ /* Network thread: handle the events returned by poll() for the
+  * descriptors filled by modesPushPollFds(). */
+ void modesPushHandleEvents(struct pollfd *fds, int n);
+
+ /* Print the push targets statistics. */
+ void modesPushShowStats(void);
+
+} // namespace
+
+#endif
@@ -0,0 +1,110 @@
+
+#include "modesUdp.h"
+#include "modesDecode.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+}
+
+namespace modeSMessage {
+
+int modesAddUdpDestination(const char *hostport) {
+    struct modesUdpOutput *u = &modesDecode::Modes.udp;
+    const char *colon = ::strrchr(hostport, ':');
+    char host[256], ip[32];
+    struct sockaddr_in *sa;
+    int port;
+
+    if (colon == NULL || colon == hostport ||
+        colon-hostport >= (int)sizeof(host)) return -1;
+    port = ::atoi(colon+1);
+    if (port <= 0 || port > 65535) return -1;
+    ::memcpy(host, hostport, colon-hostport);
+    host[colon-hostport] = '\0';
+    if (anetResolve(modesDecode::Modes.aneterr, host, ip) == ANET_ERR)
+        return -1;
+
+    if ((sa = (struct sockaddr_in*)
+         ::realloc(u->dest, sizeof(*sa)*(u->count+1))) == NULL) {
+        ::fprintf(stderr, "Out of memory allocating the UDP destination.\n");
+        ::exit(1);
+    }
+    u->dest = sa;
+    sa = &u->dest[u->count++];
+    ::memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    sa->sin_port = htons(port);
+    ::inet_aton(ip, &sa->sin_addr);
+    return 0;
+}
+
+void modesInitUdp(void) {
+    struct modesUdpOutput *u = &modesDecode::Modes.udp;
+    unsigned char ttl = u->ttl;
+
+    if (u->count == 0) return;
+    if ((u->fd = ::socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+        ::fprintf(stderr, "Error creating the UDP output socket: %s\n",
+                  ::strerror(errno));
+        ::exit(1);
+    }
+    anetNonBlock(modesDecode::Modes.aneterr, u->fd);
+    /* Only used if some destination is a multicast group. */
+    ::setsockopt(u->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+}
+
+/* Send the datagram being filled to all the destinations. */
+static void udpSend(struct modesUdpOutput *u) {
+    int j;
+
+    for (j = 0; j < u->count; j++) {
+        if (::sendto(u->fd, u->buf, u->len, 0,
+                     (struct sockaddr*)&u->dest[j], sizeof(u->dest[j])) == -1)
+            u->stat_errors++;
+    }
+    u->stat_datagrams++;
+    u->len = 0;
+}
+
+void modesUdpOutput(const char *buf, int len) {
+    struct modesUdpOutput *u = &modesDecode::Modes.udp;
+    const char *end = buf+len;
+
+    if (u->fd == -1) return;
+    while (buf < end) {
+        const char *nl = (const char*)::memchr(buf, '\n', end-buf);
+        int linelen = (nl ? nl+1 : end) - buf;
+
+        /* Start a new datagram if the line does not fit. Lines longer than
+         * a whole datagram can't be sent. */
+        if (u->len && u->len + linelen > modesDecode::MODES_NET_UDP_PAYLOAD)
+            udpSend(u);
+        if (u->len == 0)
+            u->len = ::snprintf(u->buf, sizeof(u->buf), "SEQ %lu\n", u->seq++);
+        if (u->len + linelen <= modesDecode::MODES_NET_UDP_PAYLOAD) {
+            ::memcpy(u->buf+u->len, buf, linelen);
+            u->len += linelen;
+        }
+        buf += linelen;
+    }
+    /* One datagram per batch at least, don't keep frames waiting. */
+    if (u->len) udpSend(u);
+}
+
+void modesUdpShowStats(void) {
+    struct modesUdpOutput *u = &modesDecode::Modes.udp;
+
+    if (u->count)
+        ::printf("%ld UDP datagrams sent to %d destinations, %ld errors\n",
+                 u->stat_datagrams, u->count, u->stat_errors);
+}
+
+} // namespace
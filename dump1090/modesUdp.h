@@ -0,0 +1,45 @@
+#ifndef MODESUDP_H
+#define MODESUDP_H
+
+#include "globals.h"
+
+extern "C" {
+#include <netinet/in.h>
+}
+
+namespace modeSMessage {
+
+/* UDP output of the raw feed (--net-udp), to multicast groups and / or
+ * unicast addresses. The lines of the raw output are packed in datagrams
+ * of at most MODES_NET_UDP_PAYLOAD bytes, never splitting a line. Every
+ * datagram starts with a "SEQ <n>" line, where n is incremented for every
+ * datagram, so that the receivers can detect the lost ones. */
+struct modesUdpOutput {
+    int fd;                         /* Socket, -1 if disabled. */
+    int count;                      /* Number of destinations. */
+    struct sockaddr_in *dest;       /* Destinations. */
+    int ttl;                        /* Multicast TTL. */
+    char buf[modesDecode::MODES_NET_UDP_PAYLOAD]; /* Datagram being filled. */
+    int len;
+    unsigned long seq;              /* Sequence number of the next one. */
+
+    /* Statistics */
+    long stat_datagrams;            /* Datagrams sent (to every destination). */
+    long stat_errors;               /* Failed sendto(). */
+};
+
+ /* Add a destination from an "addr:port" string. Returns -1 on error. */
+ int modesAddUdpDestination(const char *hostport);
+
+ /* Create the socket, if there are destinations. */
+ void modesInitUdp(void);
+
+ /* Pack the raw output into datagrams and send them. */
+ void modesUdpOutput(const char *buf, int len);
+
+ /* Print the UDP output statistics. */
+ void modesUdpShowStats(void);
+
+} // namespace
+
+#endif
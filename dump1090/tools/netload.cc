@@ -0,0 +1,570 @@
+/* netload -- network load generator for a dump1090 instance.
+ *
+ * Copyright (C) 2013 by A. Bach
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* The tool opens many concurrent connections against a running dump1090
+ * (usually started with --net-only) and drives all the network services
+ * at the same time:
+ *
+ * - feeders write hex frames into the raw input port (30001) at a given
+ *   aggregated rate. The time tick in front of every frame is the send
+ *   time in microseconds, so it comes back unchanged on the raw output.
+ * - raw consumers read the raw output port (30002) and use the tick to
+ *   measure the end-to-end lag of every frame, and count drops.
+ * - SBS consumers read the BaseStation port (30003) and count lines.
+ * - HTTP clients poll /data.json on the HTTP port (8080) using keep-alive
+ *   connections and measure the response time.
+ *
+ * A run is made of three phases: first all the connections are opened,
+ * then the feeders send frames for --duration seconds, and finally the
+ * tool waits --drain seconds for the outputs to catch up. Every frame
+ * sent should then be seen by every raw consumer, anything missing is
+ * accounted as dropped.
+ *
+ * Everything is handled by a single thread using non-blocking sockets
+ * and poll(), so thousands of connections are cheap. */
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+extern "C" {
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+}
+
+#include "anet.h"
+
+static const int NETLOAD_BUF_SIZE     = 4096;
+static const int NETLOAD_LAG_FINE     = 1000;  /* 10 usec buckets up to 10 ms */
+static const int NETLOAD_LAG_COARSE   = 10000; /* 1 ms buckets up to 10 s */
+static const int NETLOAD_MAX_FRAMES   = 4096;
+
+enum { KIND_FEEDER, KIND_RAW, KIND_SBS, KIND_HTTP };
+
+/* One connection to the instance under test. */
+struct conn {
+    int fd;
+    int kind;
+    int connected;                 /* Non-blocking connect completed. */
+    char buf[NETLOAD_BUF_SIZE+1];  /* Read buffer (consumers only). */
+    int buflen;
+    long received;                 /* Frames, lines or replies. */
+    long http_sent;             /* Time the pending request was sent. */
+    long http_next;             /* Time of the next request. */
+    int http_body;                 /* Bytes of body still expected. */
+};
+
+/* Built-in frames, all with a good CRC so that they are re-broadcast. */
+static const char *default_frames[] = {
+    "8d4d20232004d0f4cb1820b0efd4",
+    "8d4d2023586d60aa039d03471653",
+    "8d4d2023586d90aa979ce05a73c1",
+    "8d4d2023586db441dd891cb93e18",
+    "8d4d2023587130b0259bc69b9499",
+    "8d4d202399108fabc87414b31cb8",
+    "8d4d202399108fabe87814be3a91",
+    "5d4d20237a55a6",
+    "5f4d20232daf00"
+};
+
+static struct {
+    char *host;
+    int ri_port, ro_port, sbs_port, http_port;
+    int feeders, raw, sbs, http;
+    int rate;                      /* Aggregated frames per second. */
+    int duration, drain;           /* Seconds. */
+    int http_interval;             /* Milliseconds between two polls. */
+
+    char *frames[NETLOAD_MAX_FRAMES];
+    int frames_len;
+
+    struct conn *conns;
+    int conns_len;
+
+    long start;
+    long sent, send_errors, connect_errors, disconnects;
+    long lag_fine[NETLOAD_LAG_FINE], lag_coarse[NETLOAD_LAG_COARSE];
+    long lag_over, lag_samples;
+    long lag_max, lag_sum;
+    long http_replies;
+    long http_lat_sum, http_lat_max;
+} Load;
+
+/* Monotonic clock in microseconds. */
+static long ustime(void) {
+    struct timespec ts;
+
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void recordLag(long lag) {
+    if (lag < 0) lag = 0;
+    if (lag < NETLOAD_LAG_FINE*10) Load.lag_fine[lag/10]++;
+    else if (lag < (long)NETLOAD_LAG_COARSE*1000) Load.lag_coarse[lag/1000]++;
+    else Load.lag_over++;
+    if (lag > Load.lag_max) Load.lag_max = lag;
+    Load.lag_sum += lag;
+    Load.lag_samples++;
+}
+
+/* Return the lag percentile 'p' (0-100) in microseconds. */
+static long lagPercentile(double p) {
+    long want = (long)(Load.lag_samples * p / 100.0), seen = 0;
+    int j;
+
+    for (j = 0; j < NETLOAD_LAG_FINE; j++) {
+        seen += Load.lag_fine[j];
+        if (seen > want) return (long)j*10;
+    }
+    for (j = 0; j < NETLOAD_LAG_COARSE; j++) {
+        seen += Load.lag_coarse[j];
+        if (seen > want) return (long)j*1000;
+    }
+    return Load.lag_max;
+}
+
+static void closeConn(struct conn *c) {
+    if (c->fd == -1) return;
+    ::close(c->fd);
+    c->fd = -1;
+    Load.disconnects++;
+}
+
+static void openConn(struct conn *c, int kind) {
+    static char err[ANET_ERR_LEN];
+    int port = Load.ri_port;
+
+    if (kind == KIND_RAW) port = Load.ro_port;
+    else if (kind == KIND_SBS) port = Load.sbs_port;
+    else if (kind == KIND_HTTP) port = Load.http_port;
+
+    ::memset(c,0,sizeof(*c));
+    c->kind = kind;
+    c->fd = anetTcpNonBlockConnect(err, Load.host, port);
+    if (c->fd == ANET_ERR) {
+        ::fprintf(stderr, "connect to %s:%d: %s\n", Load.host, port, err);
+        Load.connect_errors++;
+        c->fd = -1;
+    }
+}
+
+/* Handle every complete line in the read buffer of a raw or SBS consumer. */
+static void consumeLines(struct conn *c, long now) {
+    char *line = c->buf, *nl;
+
+    c->buf[c->buflen] = '\0';
+    while ((nl = ::strchr(line, '\n')) != NULL) {
+        *nl = '\0';
+        if (c->kind == KIND_SBS) {
+            c->received++;
+        } else if (::strncmp(line, "SYNC", 4) != 0 && ::strchr(line, '*')) {
+            /* The tick in front of the frame is our send time. */
+            c->received++;
+            recordLag(now - Load.start - ::strtol(line, NULL, 10));
+        }
+        line = nl+1;
+    }
+    c->buflen -= line - c->buf;
+    ::memmove(c->buf, line, c->buflen);
+    /* A line longer than the buffer is garbage, throw it away. */
+    if (c->buflen == NETLOAD_BUF_SIZE) c->buflen = 0;
+}
+
+static void httpReplyDone(struct conn *c, long now) {
+    long lat = now - c->http_sent;
+
+    c->received++;
+    Load.http_replies++;
+    Load.http_lat_sum += lat;
+    if (lat > Load.http_lat_max) Load.http_lat_max = lat;
+    c->http_sent = 0;
+    c->http_next = now + (long)Load.http_interval*1000;
+}
+
+/* Parse HTTP replies, only the Content-Length header matters to us. */
+static void consumeHTTP(struct conn *c, long now) {
+    while (c->buflen) {
+        if (c->http_body) {
+            int n = c->buflen < c->http_body ? c->buflen : c->http_body;
+
+            c->http_body -= n;
+            c->buflen -= n;
+            ::memmove(c->buf, c->buf+n, c->buflen);
+            if (c->http_body == 0) httpReplyDone(c, now);
+        } else {
+            char *end, *cl;
+
+            c->buf[c->buflen] = '\0';
+            if ((end = ::strstr(c->buf, "\r\n\r\n")) == NULL) {
+                if (c->buflen == NETLOAD_BUF_SIZE) c->buflen = 0;
+                return;
+            }
+            cl = ::strstr(c->buf, "Content-Length:");
+            c->http_body = (cl && cl < end) ? ::atoi(cl+15) : 0;
+            c->buflen -= (end+4) - c->buf;
+            ::memmove(c->buf, end+4, c->buflen);
+            if (c->http_body == 0) httpReplyDone(c, now);
+        }
+    }
+}
+
+static void readConn(struct conn *c, long now) {
+    while (c->fd != -1) {
+        int nread = ::read(c->fd, c->buf+c->buflen,
+                           NETLOAD_BUF_SIZE-c->buflen);
+
+        if (nread <= 0) {
+            if (nread == 0 || errno != EAGAIN) closeConn(c);
+            return;
+        }
+        c->buflen += nread;
+        if (c->kind == KIND_HTTP) consumeHTTP(c, now);
+        else consumeLines(c, now);
+    }
+}
+
+static void sendHTTPRequest(struct conn *c, long now) {
+    static const char req[] =
+        "GET /data.json HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n";
+
+    if (::write(c->fd, req, sizeof(req)-1) != (int)sizeof(req)-1) {
+        closeConn(c);
+        return;
+    }
+    c->http_sent = now;
+}
+
+/* Send a single frame from a feeder. Returns 0 if the socket buffer is
+ * full so that the caller can try with the next feeder. */
+static int sendFrame(struct conn *c, long now) {
+    char line[64];
+    const char *hex = Load.frames[Load.sent % Load.frames_len];
+    int len = ::snprintf(line, sizeof(line), "%ld*%s;\n",
+                         (now - Load.start), hex);
+    int nwritten = ::write(c->fd, line, len);
+
+    if (nwritten == len) {
+        Load.sent++;
+        return 1;
+    }
+    if (nwritten == -1 && errno == EAGAIN) return 0;
+    /* A partial write would corrupt the stream: drop the feeder. */
+    Load.send_errors++;
+    closeConn(c);
+    return 0;
+}
+
+static void loadFrames(const char *filename) {
+    FILE *fp = ::fopen(filename, "r");
+    char line[256];
+
+    if (fp == NULL) {
+        ::fprintf(stderr, "Opening frames file %s: %s\n", filename,
+                  ::strerror(errno));
+        ::exit(1);
+    }
+    while (Load.frames_len < NETLOAD_MAX_FRAMES &&
+           ::fgets(line, sizeof(line), fp)) {
+        /* Accept both bare hex and the "tick*hex;" raw output format. */
+        char *hex = ::strchr(line, '*'), *end;
+
+        hex = hex ? hex+1 : line;
+        end = hex;
+        while ((*end >= '0' && *end <= '9') || (*end >= 'a' && *end <= 'f') ||
+               (*end >= 'A' && *end <= 'F')) end++;
+        *end = '\0';
+        if (end-hex == 14 || end-hex == 28)
+            Load.frames[Load.frames_len++] = ::strdup(hex);
+    }
+    ::fclose(fp);
+    if (Load.frames_len == 0) {
+        ::fprintf(stderr, "No usable frames in %s\n", filename);
+        ::exit(1);
+    }
+}
+
+/* Run the poll loop until 'until' (microseconds, monotonic).
+ * When 'feeding' is true the feeders send frames at the configured rate. */
+static void runLoop(struct pollfd *pfd, long until, int feeding) {
+    long now = ustime(), next_report = now + 1000000;
+    long feed_start = now;
+    long feed_base = Load.sent, last_sent = Load.sent;
+    long last_lag = Load.lag_samples;
+    int next_feeder = 0;
+    int j;
+
+    while ((now = ustime()) < until) {
+        int timeout = 10;
+
+        /* Frames that should have been sent so far at the given rate. */
+        if (feeding && Load.feeders) {
+            long due = feed_base + (long)((now - feed_start) * Load.rate / 1000000);
+            int tries = 0;
+
+            while (Load.sent < due && tries < Load.feeders) {
+                struct conn *c = &Load.conns[next_feeder];
+
+                next_feeder = (next_feeder+1) % Load.feeders;
+                if (c->fd == -1 || !c->connected || !sendFrame(c, now))
+                    tries++;
+                else
+                    tries = 0;
+            }
+            timeout = 1;
+        }
+
+        for (j = 0; j < Load.conns_len; j++) {
+            struct conn *c = &Load.conns[j];
+
+            pfd[j].fd = c->fd;
+            pfd[j].revents = 0;
+            pfd[j].events = c->connected ? POLLIN : POLLOUT;
+            if (c->kind == KIND_FEEDER && c->connected) pfd[j].events = 0;
+        }
+        if (::poll(pfd, Load.conns_len, timeout) == -1 && errno != EINTR) {
+            ::perror("poll");
+            ::exit(1);
+        }
+        now = ustime();
+
+        for (j = 0; j < Load.conns_len; j++) {
+            struct conn *c = &Load.conns[j];
+
+            if (c->fd == -1 || pfd[j].revents == 0) continue;
+            if (!c->connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                ::getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    ::fprintf(stderr, "connect: %s\n", ::strerror(err));
+                    Load.connect_errors++;
+                    ::close(c->fd);
+                    c->fd = -1;
+                    continue;
+                }
+                c->connected = 1;
+                continue;
+            }
+            if (pfd[j].revents & (POLLIN|POLLHUP|POLLERR)) readConn(c, now);
+        }
+
+        /* Keep HTTP clients polling. */
+        for (j = 0; j < Load.conns_len; j++) {
+            struct conn *c = &Load.conns[j];
+
+            if (c->kind != KIND_HTTP || c->fd == -1 || !c->connected ||
+                c->http_sent) continue;
+            if (now >= c->http_next) sendHTTPRequest(c, now);
+        }
+
+        if (now >= next_report) {
+            ::printf("%s: sent %ld frames/s, received %ld frames/s, "
+                     "lag max %ld us, %ld http replies, %ld disconnects\n",
+                     feeding ? "feed" : "wait", Load.sent - last_sent,
+                     Load.lag_samples - last_lag, Load.lag_max,
+                     Load.http_replies, Load.disconnects);
+            fflush(stdout);
+            last_sent = Load.sent;
+            last_lag = Load.lag_samples;
+            next_report += 1000000;
+        }
+    }
+}
+
+static void showHelp(void) {
+    ::printf(
+"--host <addr>            Instance to test (default: 127.0.0.1).\n"
+"--net-ri-port <port>     Raw input port (default: 30001).\n"
+"--net-ro-port <port>     Raw output port (default: 30002).\n"
+"--net-sbs-port <port>    BaseStation output port (default: 30003).\n"
+"--net-http-port <port>   HTTP port (default: 8080).\n"
+"--feeders <num>          Connections feeding the raw input (default: 1).\n"
+"--raw <num>              Raw output consumers (default: 1).\n"
+"--sbs <num>              BaseStation output consumers (default: 0).\n"
+"--http <num>             HTTP clients polling /data.json (default: 0).\n"
+"--http-interval <ms>     Delay between two polls of a client (default: 1000).\n"
+"--rate <frames/sec>      Aggregated feeding rate (default: 1000).\n"
+"--duration <sec>         Feeding time (default: 10).\n"
+"--drain <sec>            Time to wait for the outputs after feeding (default: 2).\n"
+"--frames <filename>      Frames to replay, hex or raw output format.\n"
+"--help                   Show this help.\n"
+    );
+}
+
+int main(int argc, char **argv) {
+    struct rlimit rl;
+    struct pollfd *pfd;
+    long raw_received = 0, sbs_received = 0;
+    int raw_alive = 0;
+    int j;
+
+    Load.host = (char*)"127.0.0.1";
+    Load.ri_port = 30001;
+    Load.ro_port = 30002;
+    Load.sbs_port = 30003;
+    Load.http_port = 8080;
+    Load.feeders = 1;
+    Load.raw = 1;
+    Load.rate = 1000;
+    Load.duration = 10;
+    Load.drain = 2;
+    Load.http_interval = 1000;
+
+    for (j = 1; j < argc; j++) {
+        int more = j+1 < argc;
+
+        if (!::strcmp(argv[j],"--host") && more) {
+            Load.host = argv[++j];
+        } else if (!::strcmp(argv[j],"--net-ri-port") && more) {
+            Load.ri_port = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--net-ro-port") && more) {
+            Load.ro_port = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--net-sbs-port") && more) {
+            Load.sbs_port = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--net-http-port") && more) {
+            Load.http_port = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--feeders") && more) {
+            Load.feeders = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--raw") && more) {
+            Load.raw = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--sbs") && more) {
+            Load.sbs = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--http") && more) {
+            Load.http = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--http-interval") && more) {
+            Load.http_interval = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--rate") && more) {
+            Load.rate = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--duration") && more) {
+            Load.duration = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--drain") && more) {
+            Load.drain = ::atoi(argv[++j]);
+        } else if (!::strcmp(argv[j],"--frames") && more) {
+            loadFrames(argv[++j]);
+        } else if (!::strcmp(argv[j],"--help")) {
+            showHelp();
+            ::exit(0);
+        } else {
+            ::fprintf(stderr,
+                "Unknown or not enough arguments for option '%s'.\n\n",
+                argv[j]);
+            showHelp();
+            ::exit(1);
+        }
+    }
+    if (Load.frames_len == 0) {
+        for (j = 0; j < (int)(sizeof(default_frames)/sizeof(char*)); j++)
+            Load.frames[Load.frames_len++] = (char*)default_frames[j];
+    }
+
+    /* Thousands of connections need more than the usual 1024 fds. */
+    Load.conns_len = Load.feeders + Load.raw + Load.sbs + Load.http;
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+        rl.rlim_cur < (rlim_t)Load.conns_len + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Load.conns = (struct conn*)::malloc(sizeof(struct conn)*Load.conns_len);
+    pfd = (struct pollfd*)::malloc(sizeof(struct pollfd)*Load.conns_len);
+    if (Load.conns == NULL || pfd == NULL) {
+        ::fprintf(stderr, "Out of memory allocating %d connections.\n",
+                  Load.conns_len);
+        ::exit(1);
+    }
+    /* Feeders first: the feeding loop relies on it. */
+    for (j = 0; j < Load.conns_len; j++) {
+        int kind = KIND_FEEDER;
+
+        if (j >= Load.feeders) kind = KIND_RAW;
+        if (j >= Load.feeders+Load.raw) kind = KIND_SBS;
+        if (j >= Load.feeders+Load.raw+Load.sbs) kind = KIND_HTTP;
+        openConn(&Load.conns[j], kind);
+    }
+
+    /* Phase 1: give the instance a second to accept everybody. */
+    Load.start = ustime();
+    runLoop(pfd, Load.start + 1000000, 0);
+    Load.disconnects = 0;
+    /* Phase 2 and 3: feed, then drain. */
+    runLoop(pfd, ustime() + (long)Load.duration*1000000, 1);
+    runLoop(pfd, ustime() + (long)Load.drain*1000000, 0);
+
+    for (j = 0; j < Load.conns_len; j++) {
+        struct conn *c = &Load.conns[j];
+
+        if (c->kind == KIND_RAW) {
+            raw_received += c->received;
+            if (c->fd != -1) raw_alive++;
+        } else if (c->kind == KIND_SBS) {
+            sbs_received += c->received;
+        }
+    }
+
+    ::printf("\n%d connections, %ld connect errors, %ld disconnects\n",
+             Load.conns_len, Load.connect_errors, Load.disconnects);
+    ::printf("%ld frames sent (%.1f frames/s), %ld send errors\n",
+             Load.sent, (double)Load.sent / (Load.duration ? Load.duration : 1),
+             Load.send_errors);
+    if (Load.raw) {
+        long expected = Load.sent * Load.raw;
+
+        ::printf("%ld frames received by %d raw consumers (%d still connected)\n",
+                 raw_received, Load.raw, raw_alive);
+        ::printf("%ld frames dropped (%.2f%%)\n", expected - raw_received,
+                 expected ? 100.0*(expected-raw_received)/expected : 0.0);
+        ::printf("lag avg %ld us, p50 %ld us, p99 %ld us, max %ld us\n",
+                 (Load.lag_samples ? Load.lag_sum/Load.lag_samples : 0),
+                 lagPercentile(50), lagPercentile(99),
+                 Load.lag_max);
+    }
+    if (Load.sbs)
+        ::printf("%ld SBS lines received by %d consumers\n",
+                 sbs_received, Load.sbs);
+    if (Load.http)
+        ::printf("%ld HTTP replies, avg %ld us, max %ld us\n",
+                 Load.http_replies,
+                 (Load.http_replies ?
+                             Load.http_lat_sum/Load.http_replies : 0),
+                 Load.http_lat_max);
+    return 0;
+}